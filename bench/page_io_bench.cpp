@@ -0,0 +1,102 @@
+// Compares writing pages one call at a time with DiskManager::WritePages runs,
+// and checks that every page reads back, directly and through BufferPoolManager.
+// Usage: page_io_bench [pages]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "b_plus_tree/include/buffer_pool_manager.h"
+
+namespace {
+
+constexpr const char *kDbFile = "page_io_bench.db";
+
+double Seconds(std::chrono::steady_clock::duration d) { return std::chrono::duration<double>(d).count(); }
+
+// the first bytes of a page name its id and a round, so a stale page is noticed
+void FillPage(char *data, int page_id, int round) {
+    memset(data, 'a' + (page_id + round) % 26, PAGE_SIZE);
+    memcpy(data, &page_id, sizeof(page_id));
+    memcpy(data + PAGE_SIZE - sizeof(round), &round, sizeof(round));
+}
+bool CheckPage(const char *data, int page_id, int round) {
+    static char expected[PAGE_SIZE];
+    FillPage(expected, page_id, round);
+    return memcmp(data, expected, PAGE_SIZE) == 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    int pages = argc > 1 ? atoi(argv[1]) : 1024;
+    std::remove(kDbFile);
+    std::vector<char> buffer(static_cast<size_t>(pages) * PAGE_SIZE);
+    std::vector<char *> data(pages);
+    for (int i = 0; i < pages; i++) data[i] = &buffer[static_cast<size_t>(i) * PAGE_SIZE];
+
+    printf("%-12s %14s\n", "write", "us/page");
+    {
+        huang::DiskManager disk(kDbFile);
+        for (int i = 0; i < pages; i++) FillPage(data[i], i, 0);
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < pages; i++)
+            if (!disk.WritePage(i, data[i])) return 1;
+        auto mid = std::chrono::steady_clock::now();
+        for (int i = 0; i < pages; i++) FillPage(data[i], i, 1);
+        if (!disk.WritePages(0, data.data(), pages)) return 1;
+        auto end = std::chrono::steady_clock::now();
+        printf("%-12s %14.2f\n", "WritePage", Seconds(mid - begin) * 1e6 / pages);
+        printf("%-12s %14.2f\n", "WritePages", Seconds(end - mid) * 1e6 / pages);
+        if (!disk.Sync()) return 1;
+    }
+    {
+        // pages past the end of the file must come back as zeros
+        huang::DiskManager disk(kDbFile);
+        std::vector<char> more(static_cast<size_t>(pages + 2) * PAGE_SIZE, 'z');
+        std::vector<char *> more_data(pages + 2);
+        for (int i = 0; i < pages + 2; i++) more_data[i] = &more[static_cast<size_t>(i) * PAGE_SIZE];
+        if (!disk.ReadPages(0, more_data.data(), pages + 2)) return 1;
+        for (int i = 0; i < pages; i++) {
+            if (!CheckPage(more_data[i], i, 1)) {
+                printf("ReadPages: page %d differs\n", i);
+                return 1;
+            }
+        }
+        for (size_t i = static_cast<size_t>(pages) * PAGE_SIZE; i < more.size(); i++) {
+            if (more[i] != 0) {
+                printf("ReadPages: byte %zu past the end is not zero\n", i);
+                return 1;
+            }
+        }
+    }
+    {
+        // a pool smaller than the file, so fetching evicts and FlushPage writes back
+        huang::DiskManager disk(kDbFile);
+        huang::Replacer<huang::Page *> replacer;
+        huang::BufferPoolManager pool(pages / 4 + 1, &disk, &replacer);
+        for (int i = 0; i < pages; i++) {
+            huang::Page *page = pool.FetchPage(i);
+            if (page == nullptr) {
+                printf("FetchPage: page %d cannot be fetched\n", i);
+                return 1;
+            }
+            if (!CheckPage(page->GetData(), i, 1)) {
+                printf("FetchPage: page %d differs\n", i);
+                return 1;
+            }
+            FillPage(page->GetData(), i, 2);
+        }
+        if (!pool.FlushAllPage()) return 1;
+        for (int i = 0; i < pages; i++) {
+            if (!disk.ReadPage(i, data[i]) || !CheckPage(data[i], i, 2)) {
+                printf("FlushAllPage: page %d differs\n", i);
+                return 1;
+            }
+        }
+    }
+    std::remove(kDbFile);
+    return 0;
+}
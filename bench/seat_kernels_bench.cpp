@@ -0,0 +1,68 @@
+// 比较余票数组上 RangeMin / RangeAdd 各实现的速度，并检查它们的结果与标量实现一致。
+// 用法：seat_kernels_bench [操作次数]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "lib/seat_kernels.h"
+
+namespace {
+
+constexpr int kStationNum = 100;  // Train::kMaxStationNum
+constexpr int kSlots = lin::SeatSlots(kStationNum);
+constexpr int kRecords = 4096;  // 大致是一批查询会碰到的 (车次, 日期) 数
+
+struct Query {
+  int record, l, r, x;
+};
+
+double Seconds(std::chrono::steady_clock::duration d) { return std::chrono::duration<double>(d).count(); }
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  int ops = argc > 1 ? atoi(argv[1]) : 4000000;
+  std::mt19937 rng(2022);
+  std::vector<Query> queries(ops);
+  for (auto &q : queries) {
+    // 区间长度从 1 到整趟车都有，和查票时一样
+    int station_num = 2 + rng() % (kStationNum - 1);
+    q.record = rng() % kRecords;
+    q.l = rng() % (station_num - 1);
+    q.r = q.l + 1 + rng() % (station_num - 1 - q.l);
+    q.x = static_cast<int>(rng() % 7) - 3;
+  }
+  std::vector<int> initial(kRecords * kSlots);
+  for (auto &seat : initial) seat = rng() % 100000;
+
+  long long expected_sum = 0;
+  std::vector<int> expected;
+  const lin::SeatKernel kernels[] = {lin::SeatKernel::kScalar, lin::SeatKernel::kSse4, lin::SeatKernel::kAvx2};
+  printf("%-8s %14s %14s\n", "kernel", "min ns/op", "add ns/op");
+  for (auto kernel : kernels) {
+    if (!lin::UseSeatKernel(kernel)) {
+      printf("%-8s %14s %14s\n", lin::SeatKernelName(kernel), "-", "-");
+      continue;
+    }
+    std::vector<int> seats = initial;
+    long long sum = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (auto &q : queries) sum += lin::SeatRangeMin(&seats[q.record * kSlots], q.l, q.r);
+    auto mid = std::chrono::steady_clock::now();
+    for (auto &q : queries) lin::SeatRangeAdd(&seats[q.record * kSlots], q.l, q.r, q.x);
+    auto end = std::chrono::steady_clock::now();
+    printf("%-8s %14.2f %14.2f\n", lin::SeatKernelName(kernel), Seconds(mid - begin) * 1e9 / ops,
+        Seconds(end - mid) * 1e9 / ops);
+    if (kernel == lin::SeatKernel::kScalar) {
+      expected_sum = sum;
+      expected = seats;
+    } else if (sum != expected_sum || seats != expected) {
+      printf("%s disagrees with scalar\n", lin::SeatKernelName(kernel));
+      return 1;
+    }
+  }
+  return 0;
+}
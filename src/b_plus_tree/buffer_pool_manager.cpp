@@ -1,5 +1,8 @@
 #include "include/buffer_pool_manager.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "include/b_plus_tree_page.hpp"
 
 namespace huang {
@@ -22,8 +25,15 @@ Page *BufferPoolManager::FetchPage(page_id_t page_id) {
         return page_map_.at(page_id);
     } catch (...) {
         Page *pg = FindUnusedPage(page_id);
-        disk_manager_->ReadPage(page_id, pg->data_);
-
+        if (pg == nullptr) return nullptr;
+        if (!disk_manager_->ReadPage(page_id, pg->data_)) {
+            // give the frame back rather than cache a page that was never read
+            replacer_->Erase(pg);
+            page_map_.erase(page_map_.find(page_id));
+            page_id_map_.erase(page_id_map_.find(pg));
+            free_.push_back(pg);
+            return nullptr;
+        }
         return pg;
     }
 }
@@ -38,8 +48,8 @@ Page *BufferPoolManager::FetchPage(page_id_t page_id) {
 bool BufferPoolManager::FlushPage(page_id_t page_id) {
     Page *pg = page_map_[page_id];
     if (pg->is_dirty_) {
+        if (!disk_manager_->WritePage(page_id, pg->data_)) return false;
         pg->is_dirty_ = false;
-        disk_manager_->WritePage(page_id, pg->data_);
     }
     return true;
 };
@@ -58,7 +68,7 @@ void BufferPoolManager::CheckPage(page_id_t page_id){
 }
 
 bool BufferPoolManager::DeletePage(page_id_t page_id){
-
+    return false;  // pages are never deleted yet
 };
 
 Page *BufferPoolManager::FindUnusedPage(const page_id_t &page_id) {
@@ -70,7 +80,10 @@ Page *BufferPoolManager::FindUnusedPage(const page_id_t &page_id) {
         if (!replacer_->Victim(page)) return nullptr;
         page_id_t old_page_id = page_id_map_[page];
         page_map_[old_page_id] = page;
-        FlushPage(old_page_id);
+        if (!FlushPage(old_page_id)) {
+            replacer_->Insert(page);  // keep the page that could not be written
+            return nullptr;
+        }
         page_map_.erase(page_map_.find(old_page_id));
         page_id_map_.erase(page_id_map_.find(page));
         page->Clear();
@@ -82,9 +95,31 @@ Page *BufferPoolManager::FindUnusedPage(const page_id_t &page_id) {
     return page;
 };
 
-void BufferPoolManager::FlushAllPage() {
+bool BufferPoolManager::FlushAllPage() {
+    // sort the dirty pages by id, then write each run of consecutive pages
+    // with a single vectored write
+    std::vector<std::pair<page_id_t, Page *>> dirty;
     for (auto it = page_map_.begin(); it != page_map_.end(); it++)
-        FlushPage(it->first);
+        if (it->second->is_dirty_) dirty.emplace_back(it->first, it->second);
+    std::sort(dirty.begin(), dirty.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    bool ok = true;
+    std::vector<const char *> run;
+    for (size_t i = 0; i < dirty.size(); i++) {
+        run.push_back(dirty[i].second->data_);
+        if (i + 1 == dirty.size() || dirty[i + 1].first != dirty[i].first + 1) {
+            // a run that failed stays dirty, so a later flush retries it
+            if (disk_manager_->WritePages(dirty[i].first - run.size() + 1,
+                                          run.data(), run.size())) {
+                for (size_t j = i + 1 - run.size(); j <= i; j++)
+                    dirty[j].second->is_dirty_ = false;
+            } else {
+                ok = false;
+            }
+            run.clear();
+        }
+    }
+    return ok;
 };
 
 }  // namespace huang
\ No newline at end of file
@@ -1,40 +1,104 @@
 #include "include/disk_manager.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
 namespace huang {
+namespace {
+// keep each vectored call below the usual IOV_MAX
+constexpr int kMaxIov = 1024;
+
+// Drops the first `bytes` bytes from `iov[0, num)` after a short transfer.
+void AdvanceIov(iovec *&iov, int &num, size_t bytes) {
+    for (; num > 0 && bytes >= iov->iov_len; iov++, num--) bytes -= iov->iov_len;
+    if (num > 0) {
+        iov->iov_base = static_cast<char *>(iov->iov_base) + bytes;
+        iov->iov_len -= bytes;
+    }
+}
+}  // namespace
+
 DiskManager::DiskManager(const std::string &db_file) {
-    // with file open
     file_name_ = db_file;
-    db_io_.open(db_file, std::ios::binary | std::ios::in | std::ios::out);
-    // directory or file does not exist
-    if (!db_io_.is_open()) {
-        db_io_.clear();
-        // create a new file
-        db_io_.open(db_file, std::ios::out);
-        // reopen with original mode
-        // db_io_.open(db_file, std::ios::binary | std::ios::in |
-        // std::ios::out);
-    }
-    db_io_.close();
+    // open the file once, create it if it does not exist
+    db_fd_ = open(db_file.c_str(), O_RDWR | O_CREAT, 0644);
+    if (db_fd_ < 0) std::cerr << "cannot open " << db_file << std::endl;
+    next_page_id_ = GetFileSize(db_file) / PAGE_SIZE;
+}
+DiskManager::~DiskManager() {
+    if (db_fd_ >= 0) close(db_fd_);
+}
+int DiskManager::GetFileSize(const std::string &file_name) {
+    struct stat st;
+    if (fstat(db_fd_, &st) != 0) return 0;
+    return st.st_size;
 }
-DiskManager::~DiskManager() { }
-void DiskManager::ReadPage(page_id_t page_id, char *page_data) {
-    size_t offset = page_id * PAGE_SIZE;
-    // set write cursor to offset
-    db_io_.open(file_name_, std::ios::binary | std::ios::in | std::ios::out);
-    db_io_.seekp(offset);
-    db_io_.read(page_data, PAGE_SIZE);
-    db_io_.close();
+bool DiskManager::ReadPage(page_id_t page_id, char *page_data) {
+    return ReadPages(page_id, &page_data, 1);
 }
 
-void DiskManager::WritePage(page_id_t page_id, const char *page_data) {
-    int offset = page_id * PAGE_SIZE;
-    // set read cursor to offset
-    db_io_.open(file_name_, std::ios::binary | std::ios::in | std::ios::out);
-    db_io_.seekp(offset);
-    db_io_.write(page_data, PAGE_SIZE);
-    db_io_.close();
+bool DiskManager::WritePage(page_id_t page_id, const char *page_data) {
+    return WritePages(page_id, &page_data, 1);
 }
 
+bool DiskManager::ReadPages(page_id_t first_page_id, char *const *pages_data, int count) {
+    for (int done = 0; done < count; done += kMaxIov) {
+        int n = std::min(count - done, kMaxIov), left = n;
+        iovec iov[kMaxIov], *cur = iov;
+        for (int i = 0; i < n; i++) iov[i] = {pages_data[done + i], PAGE_SIZE};
+        off_t offset = static_cast<off_t>(first_page_id + done) * PAGE_SIZE;
+        size_t got = 0;
+        while (left > 0) {
+            ssize_t ret = preadv(db_fd_, cur, left, offset + got);
+            if (ret < 0 && errno == EINTR) continue;
+            if (ret < 0) {
+                std::cerr << "cannot read " << file_name_ << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+            if (ret == 0) break;  // end of file
+            got += ret;
+            AdvanceIov(cur, left, ret);
+        }
+        // pages past the end of the file read as zero
+        for (int i = got / PAGE_SIZE; i < n; i++) {
+            size_t keep = i == static_cast<int>(got / PAGE_SIZE) ? got % PAGE_SIZE : 0;
+            memset(pages_data[done + i] + keep, 0, PAGE_SIZE - keep);
+        }
+    }
+    return true;
+}
+
+bool DiskManager::WritePages(page_id_t first_page_id, const char *const *pages_data, int count) {
+    for (int done = 0; done < count; done += kMaxIov) {
+        int n = std::min(count - done, kMaxIov), left = n;
+        iovec iov[kMaxIov], *cur = iov;
+        for (int i = 0; i < n; i++) iov[i] = {const_cast<char *>(pages_data[done + i]), PAGE_SIZE};
+        off_t offset = static_cast<off_t>(first_page_id + done) * PAGE_SIZE;
+        while (left > 0) {
+            ssize_t ret = pwritev(db_fd_, cur, left, offset);
+            if (ret < 0 && errno == EINTR) continue;
+            if (ret <= 0) {
+                // a zero-byte write would never finish, report it like an error
+                std::cerr << "cannot write " << file_name_ << ": " << (ret < 0 ? strerror(errno) : "no progress")
+                          << std::endl;
+                return false;
+            }
+            offset += ret;
+            AdvanceIov(cur, left, ret);
+        }
+    }
+    return true;
+}
+
+bool DiskManager::Sync() { return fdatasync(db_fd_) == 0; }
+
 page_id_t DiskManager::AllocatePage() { return next_page_id_++; }
 
-};  // namespace huang
\ No newline at end of file
+void DiskManager::DeallocatePage(page_id_t page_id) {}
+
+};  // namespace huang
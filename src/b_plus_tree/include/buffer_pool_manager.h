@@ -28,7 +28,8 @@ class BufferPoolManager {
     /**
      * Fetch the requested page from the buffer pool.
      * @param page_id id of page to be fetched
-     * @return the requested page
+     * @return the requested page, or nullptr if it could not be read or no
+     * frame could be freed for it
      */
     Page *FetchPage(page_id_t page_id);
 
@@ -45,8 +46,8 @@ class BufferPoolManager {
     /**
      * Flushes the target page to disk.
      * @param page_id id of page to be flushed, cannot be INVALID_PAGE_ID
-     * @return false if the page could not be found in the page table, true
-     * otherwise
+     * @return false if the page could not be found in the page table or
+     * could not be written (it then stays dirty), true otherwise
      */
     bool FlushPage(page_id_t page_id);
 
@@ -70,8 +71,9 @@ class BufferPoolManager {
 
     /**
      * Flushes all the pages in the buffer pool to disk.
+     * @return false if some page could not be written; it stays dirty
      */
-    void FlushAllPage();
+    bool FlushAllPage();
     
     DiskManager *disk_manager_;
 
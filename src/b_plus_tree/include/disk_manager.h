@@ -1,7 +1,6 @@
 #pragma once
 
 // #include <atomic>
-#include <fstream>
 // #include <future>  // NOLINT
 // #include <mutex>   // NOLINT
 #include <iostream>
@@ -15,6 +14,11 @@ namespace huang {
  * database. It performs the reading and writing of pages to and from disk,
  * providing a logical file layer within the context of a database management
  * system.
+ *
+ * The database file stays open for the lifetime of the DiskManager. Pages
+ * are transferred with positional reads and writes, so no seek state is
+ * shared between calls, and runs of consecutive pages can be transferred
+ * with a single vectored call.
  */
 class DiskManager {
    public:
@@ -30,22 +34,44 @@ class DiskManager {
      * Write a page to the database file.
      * @param page_id id of the page
      * @param page_data raw page data
+     * @return false if the page could not be written
      */
-    void WritePage(page_id_t page_id, const char *page_data);
+    bool WritePage(page_id_t page_id, const char *page_data);
 
     /**
      * Read a page from the database file.
      * @param page_id id of the page
      * @param[out] page_data output buffer
+     * @return false if the page could not be read
      */
-    void ReadPage(page_id_t page_id, char *page_data);
+    bool ReadPage(page_id_t page_id, char *page_data);
+
+    /**
+     * Write `count` consecutive pages starting at `first_page_id` with one
+     * vectored write.
+     * @param pages_data raw data of each page, in page id order
+     * @return false if a write failed; a prefix of the pages may be written
+     */
+    bool WritePages(page_id_t first_page_id, const char *const *pages_data, int count);
+
+    /**
+     * Read `count` consecutive pages starting at `first_page_id` with one
+     * vectored read. Pages past the end of the file are zero-filled.
+     * @param[out] pages_data output buffer of each page, in page id order
+     * @return false if a read failed
+     */
+    bool ReadPages(page_id_t first_page_id, char *const *pages_data, int count);
+
+    /** Force all written pages to stable storage. @return false on failure */
+    bool Sync();
+
     page_id_t AllocatePage();
     void DeallocatePage(page_id_t page_id);
 
    private:
     int GetFileSize(const std::string &file_name);
-    // stream to write db file
-    std::fstream db_io_;
+    // descriptor of the db file, opened once in the constructor
+    int db_fd_ = -1;
     std::string file_name_;
 
    public:
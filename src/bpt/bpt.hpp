@@ -1,9 +1,12 @@
 #pragma once
 
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 // #include <vector>
+#include "../lib/utils.h"
 #include "../lib/vector.h"
 #include "bufferpool.hpp"
 namespace huang {
@@ -13,158 +16,385 @@ namespace huang {
  * - We only support unique key.
  * - Support insert & remove.
  * - The structure should shrink and grow dynamically.
+ *
+ * Nodes are never copied out of the buffer pools: traversal code pins a
+ * frame, works on it in place and marks it dirty if it changed.
+ * With StorageMode::kMmap both files are memory-mapped instead, and a node is
+ * reached by pointer arithmetic on `pos * sizeof(Node) + INTSIZE`.
+ *
+ * Nodes freed by merges are kept in a free list per file, linked through
+ * `son[0]` of internal nodes and `nxt` of leaves, and are reused before the
+ * files grow. Compact() rewrites the leaf chain contiguously in key order.
+ *
+ * Leaves form a doubly linked list (`prv` / `nxt`), which a Cursor walks in
+ * either direction without copying the values out.
+ *
+ * When the process-wide LogManager is enabled, every changed node and both
+ * file headers go through the redo log, and the tree always uses the buffer
+ * pool: a shared mapping could be written back by the OS before it is logged.
  */
 template <class Key, class Value, int kInternalSize = 400, int kLeafSize = 10, int kInternalBufferSize = 400,
     int kLeafBufferSize = 400>
-class BPlusTree {
+class BPlusTree : public LogClient {
  public:
-  BPlusTree(const std::string& name) {
+  class Cursor;
+
+  BPlusTree(const std::string& name, StorageMode mode = StorageMode::kBufferPool) {
     tree_filename = name + "tree.dat";
     leaf_filename = name + "leaf.dat";
 
     tree_file.open(tree_filename);
     leaf_file.open(leaf_filename);
-    if (!leaf_file || !tree_file) {
+    // files cut short before their first header was written count as missing
+    bool exist = leaf_file && tree_file && FileSize(tree_file) >= INTSIZE && FileSize(leaf_file) >= INTSIZE;
+    if (!exist) {
       tree_file.open(tree_filename, std::ios::out);
       leaf_file.open(leaf_filename, std::ios::out);
-      root.Set(1, 1, true);
-      root.son[0] = 1;
-      size = 0;
-      last_internal = last_leaf = 1;
-
-      Leaf leaff(0, 1, 0);
-      WriteLeaf(leaff);
       tree_file.close();
       leaf_file.close();
       tree_file.open(tree_filename);
       leaf_file.open(leaf_filename);
+    }
+    // internal nodes are few and on every path, so leaves give up their frames first
+    internal_pool.Open(&tree_file, tree_filename, INTSIZE, 1);
+    leaf_pool.Open(&leaf_file, leaf_filename, INTSIZE);
+    if (LogManager::Instance().Enabled()) {
+      log_ = &LogManager::Instance();
+      log_->Register(this);
+      tree_file_id = log_->AddFile(tree_filename);
+      leaf_file_id = log_->AddFile(leaf_filename);
+      Track(true);
+    } else if (mode == StorageMode::kMmap) {
+      // the header is still read and written through the streams, which share the page cache with the mapping
+      if (!internal_pool.Map() || !leaf_pool.Map())
+        std::cerr << "cannot map " << name << ", falling back to the buffer pool" << std::endl;
+    }
+    if (!exist) {
+      size = 0;
+      last_internal = last_leaf = 0;
+      free_internal = free_leaf = 0;
+      free_internal_num = free_leaf_num = 0;
+
+      InternalGuard root = NewInternal(1, true);
+      root->son[0] = NewLeaf(0, 0, 0)->pos;
+      root_pos = root->pos;
     } else {
       tree_file.seekg(0);
-      int tree_rt;
-      tree_file.read(reinterpret_cast<char*>(&tree_rt), sizeof(int));
+      tree_file.read(reinterpret_cast<char*>(&root_pos), sizeof(int));
       tree_file.read(reinterpret_cast<char*>(&last_internal), sizeof(int));
-      tree_file.seekg(INTSIZE + tree_rt * sizeof(Internal));
-      tree_file.read(reinterpret_cast<char*>(&root), sizeof(Internal));
+      tree_file.read(reinterpret_cast<char*>(&free_internal), sizeof(int));
+      tree_file.read(reinterpret_cast<char*>(&free_internal_num), sizeof(int));
 
       leaf_file.seekg(0);
       leaf_file.read(reinterpret_cast<char*>(&last_leaf), sizeof(int));
       leaf_file.read(reinterpret_cast<char*>(&size), sizeof(int));
+      leaf_file.read(reinterpret_cast<char*>(&free_leaf), sizeof(int));
+      leaf_file.read(reinterpret_cast<char*>(&free_leaf_num), sizeof(int));
     }
   }
   ~BPlusTree() {
-    tree_file.seekp(0);
-    tree_file.write(reinterpret_cast<char*>(&root.pos), sizeof(int));
-    tree_file.write(reinterpret_cast<char*>(&last_internal), sizeof(int));
-    WriteInternal(root);
-
-    leaf_file.seekp(0);
-    leaf_file.write(reinterpret_cast<char*>(&last_leaf), sizeof(int));
-    leaf_file.write(reinterpret_cast<char*>(&size), sizeof(int));
-
-    while (!internal_pool.Empty()) {
-      Internal tmp = internal_pool.Pop();
-      tree_file.seekp(tmp.pos * sizeof(Internal) + INTSIZE);
-      tree_file.write(reinterpret_cast<char*>(&tmp), sizeof(Internal));
-    }
-    while (!leaf_pool.Empty()) {
-      Leaf tmp = leaf_pool.Pop();
-      leaf_file.seekp(tmp.pos * sizeof(Leaf) + INTSIZE);
-      leaf_file.write(reinterpret_cast<char*>(&tmp), sizeof(Leaf));
+    // reclaim space when a large part of the leaf file is on the free list; done while the tree
+    // is still attached to the log, so that Compact() runs between a checkpoint and a sync
+    if (last_leaf >= kCompactMinLeaves && free_leaf_num * 4 > last_leaf) Compact();
+    if (log_) {
+      // everything logged so far goes to the files, then the log forgets this tree
+      log_->Checkpoint();
+      log_->Unregister(this);
+      Track(false);
+      log_ = nullptr;
     }
 
-    //�ռ���� TODO
+    WriteHeaders();
+    internal_pool.FlushAll();
+    leaf_pool.FlushAll();
 
     tree_file.close();
     leaf_file.close();
   }
-  /// Returns true if this B+ tree has no keys and values. 
+  /// Returns true if this B+ tree has no keys and values.
   bool Empty() { return size == 0; }
-  /// Inserts a key-value pair into this B+ tree. 
-  void Insert(const Key& key, const Value& value) {
-    if (InsertIfFatherSplit({key, value}, root)) {
-      int m = kInternalSize / 2;
-      Internal new_brother(m, GetInternalIndex(), root.is_leaf);
-      Internal new_root(2, GetInternalIndex(), false);
-
-      for (int i = 0; i < m; i++) new_brother.son[i] = root.son[m + i];
-      for (int i = 0; i < m - 1; i++) new_brother.key[i] = root.key[m + i];
-      root.num = m;
-      WriteInternal(new_brother);
-      WriteInternal(root);
-
-      new_root.son[0] = root.pos;
-      new_root.son[1] = new_brother.pos;
-      new_root.key[0] = root.key[m - 1];
-      root = new_root;
-
-      WriteInternal(root);
+  /// Returns the number of key-value pairs.
+  int Size() { return size; }
+  /// Inserts a key-value pair into this B+ tree.
+  void Insert(const Key& key, const Value& value) { InsertOrAssign({key, value}, false); }
+  /**
+   * Inserts a key-value pair, or overwrites the value if the key is already
+   * present, in one traversal. Returns true if the key was new.
+   */
+  bool Upsert(const Key& key, const Value& value) {
+    int old_size = size;
+    InsertOrAssign({key, value}, true);
+    return size != old_size;
+  }
+  /**
+   * Calls `fn(Value&)` on the value stored under `key`, in place in its leaf,
+   * and marks the leaf dirty. Returns false, without calling `fn`, if the key
+   * is not present. `fn` must not modify this tree.
+   */
+  template <class Fn>
+  bool Update(const Key& key, Fn fn) {
+    LeafGuard leaf = FindLeaf(key);
+    int pos = BinSearchLeafKey(key, *leaf);
+    if (pos == leaf->num || !(leaf->val[pos].first == key)) return false;
+    fn(leaf->val[pos].second);
+    leaf.MarkDirty();
+    return true;
+  }
+  /**
+   * Loads many key-value pairs at once. On an empty tree, the leaves and then
+   * each internal level are built bottom-up, every node filled to about
+   * `fill_factor` of its capacity but at least half full, except a level that
+   * fits in a single node. On a
+   * non-empty tree the pairs are inserted one by one in key order.
+   * Keys must be unique. Unless `sorted` is true, `pairs` is sorted in place.
+   */
+  void BulkLoad(lin::vector<std::pair<Key, Value>>& pairs, bool sorted = false, double fill_factor = 1.0) {
+    if (!sorted)
+      lin::Sort(pairs.begin(), pairs.end(),
+          [](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) { return a.first < b.first; });
+    if (!Empty() || pairs.empty()) {
+      for (size_t i = 0; i < pairs.size(); i++) Insert(pairs[i].first, pairs[i].second);
+      return;
     }
+    // the new nodes stay unreachable until the root is swapped at the end, so
+    // the tree is consistent whenever the redo log commits in between
+    // (position, largest key) of every node on the level being built
+    lin::vector<std::pair<int, Key>> level;
+    int n = pairs.size();
+    int leaves = BulkNodeCount(n, kLeafSize, fill_factor);
+    LeafGuard prev;
+    for (int i = 0, begin = 0; i < leaves; i++) {
+      int end = static_cast<long long>(n) * (i + 1) / leaves;
+      LeafGuard leaf = NewLeaf(end - begin, i > 0 ? prev->pos : 0, 0);
+      for (int j = begin; j < end; j++) leaf->val[j - begin] = pairs[j];
+      if (i > 0) {
+        prev->nxt = leaf->pos;
+        prev.MarkDirty();
+      }
+      level.push_back({leaf->pos, pairs[end - 1].first});
+      prev = std::move(leaf);
+      begin = end;
+      if (log_) log_->CommitIfFull();
+    }
+    prev.Release();
+    bool is_leaf = true;
+    do {
+      lin::vector<std::pair<int, Key>> upper;
+      int num = level.size(), nodes = BulkNodeCount(num, kInternalSize, fill_factor);
+      for (int i = 0, begin = 0; i < nodes; i++) {
+        int end = static_cast<long long>(num) * (i + 1) / nodes;
+        InternalGuard internal = NewInternal(end - begin, is_leaf);
+        for (int j = begin; j < end; j++) {
+          internal->son[j - begin] = level[j].first;
+          if (j + 1 < end) internal->key[j - begin] = level[j].second;
+        }
+        upper.push_back({internal->pos, level[end - 1].second});
+        begin = end;
+        internal.Release();
+        if (log_) log_->CommitIfFull();
+      }
+      level = std::move(upper);
+      is_leaf = false;
+    } while (level.size() > 1);
+    {
+      // drop the empty root and its leaf
+      InternalGuard root = FetchInternal(root_pos);
+      LeafGuard leaf = FetchLeaf(root->son[0]);
+      FreeLeaf(leaf);
+      FreeInternal(root);
+    }
+    root_pos = level[0].first;
+    size = n;
   }
   /// Removes a key and its value from this B+ tree.
   void Remove(const Key& key) {
+    InternalGuard root = FetchInternal(root_pos);
     if (RemoveIfFatherMerge(key, root)) {
-      if (!root.is_leaf && root.num == 1) {
-        Internal son;
-        ReadInternal(son, root.son[0]);
-        internal_pool.Remove(root.pos);
-        root = son;
+      if (!root->is_leaf && root->num == 1) {
+        root_pos = root->son[0];
+        FreeInternal(root);
       }
     }
   }
-  /// Returns the value associated with a given key. 
+  /// Returns the value associated with a given key.
   std::pair<bool, Value> GetValue(const Key& key) {
-    Value ret;
-    bool flag = true;
-    Internal tmp = root;
-    while (!tmp.is_leaf) {
-      int pos = BinSearchInternalKey(key, tmp);
-      ReadInternal(tmp, tmp.son[pos]);
-    }
-    int pos_leaf = BinSearchInternalKey(key, tmp);
-    ReadLeaf(leaf, tmp.son[pos_leaf]);
-    int pos = BinSearchLeafKey(key, leaf);
-    if (pos == leaf.num || !(leaf.val[pos].first == key))
-      flag = false;
-    else
-      ret = leaf.val[pos].second;
-    return {flag, ret};
-  }
-  /// Returns all values between two keys. 
-  void GetValue(const Key& min_key, const Key& max_key, lin::vector<Value>* ans) {
-    Internal tmp = root;
-    while (!tmp.is_leaf) {
-      int pos = BinSearchInternalKey(min_key, tmp);
-      ReadInternal(tmp, tmp.son[pos]);
-    }
-    int pos_leaf = BinSearchInternalKey(min_key, tmp);
-    ReadLeaf(leaf, tmp.son[pos_leaf]);
-    while (true) {
-      int i;
-      for (i = 0; i < leaf.num; i++)
-        if (min_key <= leaf.val[i].first) break;
-      for (int j = i; j < leaf.num; j++)
-        if (leaf.val[j].first <= max_key)
-          ans->push_back(leaf.val[j].second);
+    LeafGuard leaf = FindLeaf(key);
+    int pos = BinSearchLeafKey(key, *leaf);
+    if (pos == leaf->num || !(leaf->val[pos].first == key)) return {false, Value()};
+    return {true, leaf->val[pos].second};
+  }
+  /**
+   * Looks up many keys in one pass and calls `fn(i, value)` for each keys[i]
+   * that is present, with the value still in its leaf. The keys are visited
+   * in sorted order, and are only sorted here if they are not already: a key
+   * in the same leaf as the previous one costs a binary search, a key in the
+   * next leaf one step along the leaf chain, and only a key further away
+   * walks down from the root again. `fn` must not modify the tree.
+   */
+  template <class Fn>
+  void MultiGet(const lin::vector<Key>& keys, Fn fn) {
+    VisitKeys(keys, [&](int i, LeafGuard& leaf, int pos) { fn(i, leaf->val[pos].second); });
+  }
+  /**
+   * Like MultiGet(), but `fn(i, Value&)` may change the value in place. Each
+   * leaf it is called on is marked dirty.
+   */
+  template <class Fn>
+  void MultiUpdate(const lin::vector<Key>& keys, Fn fn) {
+    VisitKeys(keys, [&](int i, LeafGuard& leaf, int pos) {
+      fn(i, leaf->val[pos].second);
+      leaf.MarkDirty();
+    });
+  }
+  /**
+   * Inserts many pairs whose keys are not in the tree yet. The pairs are
+   * sorted first. The ones that land in the same leaf are merged into it in
+   * one pass while it has room; only the ones that would fill it up go
+   * through Insert() and its splits.
+   */
+  void MultiInsert(lin::vector<std::pair<Key, Value>>& pairs) {
+    lin::Sort(pairs.begin(), pairs.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    lin::vector<int> rest;
+    for (size_t i = 0, j; i < pairs.size(); i = j) {
+      LeafGuard leaf = FindLeaf(pairs[i].first);
+      for (j = i + 1; leaf->num > 0 && j < pairs.size() && pairs[j].first <= leaf->val[leaf->num - 1].first; j++) {}
+      // a full leaf has to split, so leave it one short of kLeafSize
+      size_t room = leaf->num + 1 < kLeafSize ? kLeafSize - 1 - leaf->num : 0;
+      size_t fit = j - i < room ? j - i : room;
+      for (size_t k = i + fit; k < j; k++) rest.push_back(k);
+      if (fit == 0) continue;
+      // merge from the back so that nothing is moved twice
+      int a = leaf->num - 1, out = leaf->num + fit - 1;
+      for (size_t b = i + fit; b > i;) {
+        if (a >= 0 && pairs[b - 1].first < leaf->val[a].first)
+          leaf->val[out--] = leaf->val[a--];
         else
-          return;
-      if (!leaf.nxt)
-        return;
-      else
-        ReadLeaf(leaf, leaf.nxt);
+          leaf->val[out--] = pairs[--b];
+      }
+      leaf->num += fit;
+      size += fit;
+      leaf.MarkDirty();
+    }
+    for (size_t i = 0; i < rest.size(); i++) Insert(pairs[rest[i]].first, pairs[rest[i]].second);
+  }
+  /**
+   * Removes many keys. The keys that share a leaf are taken out of it in one
+   * pass, as long as the leaf stays at least half full; only the keys that
+   * would make it underflow go through Remove() and its rebalancing.
+   * Absent keys are ignored.
+   */
+  void MultiRemove(lin::vector<Key> keys) {
+    lin::Sort(keys.begin(), keys.end(), [](const Key& a, const Key& b) { return a < b; });
+    lin::vector<Key> rest;
+    for (size_t i = 0, j; i < keys.size(); i = j) {
+      LeafGuard leaf = FindLeaf(keys[i]);
+      if (leaf->num == 0) return;
+      const Key last = leaf->val[leaf->num - 1].first;
+      for (j = i; j < keys.size() && keys[j] <= last; j++) {}
+      if (j == i) j++;  // past the last leaf, so absent
+      int removed = 0, num = 0;
+      size_t k = i;
+      for (int pos = 0; pos < leaf->num; pos++) {
+        while (k < j && keys[k] < leaf->val[pos].first) k++;
+        if (k < j && keys[k] == leaf->val[pos].first) {
+          k++;
+          if (leaf->num - removed > kLeafSize / 2) {
+            removed++;
+            continue;
+          }
+          rest.push_back(leaf->val[pos].first);
+        }
+        leaf->val[num++] = leaf->val[pos];
+      }
+      if (removed > 0) {
+        leaf->num = num;
+        size -= removed;
+        leaf.MarkDirty();
+      }
     }
+    for (size_t i = 0; i < rest.size(); i++) Remove(rest[i]);
+  }
+  /// Returns all values between two keys.
+  void GetValue(const Key& min_key, const Key& max_key, lin::vector<Value>* ans) {
+    for (Cursor it = SeekForward(min_key); it.Valid() && it->first <= max_key; it.Next()) ans->push_back(it->second);
+  }
+  /// Returns a cursor at the first pair whose key is not less than `key`.
+  Cursor SeekForward(const Key& key) {
+    LeafGuard leaf = FindLeaf(key);
+    int pos = BinSearchLeafKey(key, *leaf);
+    Cursor cursor(this, std::move(leaf), pos);
+    if (pos == cursor.leaf_->num) cursor.Next();
+    return cursor;
+  }
+  /// Returns a cursor at the last pair whose key is not greater than `key`.
+  Cursor SeekBackward(const Key& key) {
+    LeafGuard leaf = FindLeaf(key);
+    int pos = BinSearchLeafKey(key, *leaf);
+    bool found = pos < leaf->num && leaf->val[pos].first == key;
+    Cursor cursor(this, std::move(leaf), found ? pos : pos - 1);
+    if (!found) {
+      cursor.pos_++;
+      cursor.Prev();
+    }
+    return cursor;
   }
   /// Updates the value that the given key maps to.
   void Modify(const Key& key, const Value& new_value) {
-    Internal tmp = root;
-    while (!tmp.is_leaf) {
-      int pos = BinSearchInternalKey(key, tmp);
-      ReadInternal(tmp, tmp.son[pos]);
+    LeafGuard leaf = FindLeaf(key);
+    int pos = BinSearchLeafKey(key, *leaf);
+    leaf->val[pos].second = new_value;
+    leaf.MarkDirty();
+  }
+  /**
+   * Rewrites the leaf chain contiguously in key order at positions 1..n and
+   * shrinks the leaf file, which also empties the leaf free list.
+   * Must not run while a cursor or guard into this tree is alive.
+   * The new leaves go to a separate file that replaces the leaf file only once
+   * it is completely written and synced; if that fails, nothing changes.
+   * Compaction itself is not logged: the trees are checkpointed before it and
+   * this one is synced after it, a crash in between loses the tree.
+   */
+  void Compact() {
+    if (log_) {
+      log_->Checkpoint();
+      Track(false);
     }
-    int pos_leaf = BinSearchInternalKey(key, tmp);
-    ReadLeaf(leaf, tmp.son[pos_leaf]);
-    int pos = BinSearchLeafKey(key, leaf);
-    leaf.val[pos].second = new_value;
-    WriteLeaf(leaf);
+    lin::vector<int> new_pos;
+    for (int i = 0; i <= last_leaf; i++) new_pos.push_back(0);
+    int count = 0;
+    for (int pos = FirstLeaf(); pos;) {
+      LeafGuard leaf = FetchLeaf(pos);
+      new_pos[pos] = ++count;
+      pos = leaf->nxt;
+    }
+    if (WriteCompactedLeaves(count)) {
+      leaf_pool.Reload();
+      RelinkLeaves(root_pos, new_pos);
+      last_leaf = count;
+      free_leaf = free_leaf_num = 0;
+    }
+    if (log_) {
+      Flush();
+      Track(true);
+    }
+  }
+  void WriteLog(LogManager& log) override {
+    internal_pool.WriteLog();
+    leaf_pool.WriteLog();
+    int header[4];
+    TreeHeader(header);
+    log.Append(tree_file_id, 0, header, INTSIZE);
+    LeafHeader(header);
+    log.Append(leaf_file_id, 0, header, INTSIZE);
+  }
+  void Flush() override {
+    WriteHeaders();
+    internal_pool.FlushAll();
+    leaf_pool.FlushAll();
+    tree_file.flush();
+    leaf_file.flush();
+    SyncFile(tree_filename);
+    SyncFile(leaf_filename);
   }
   void Debug() { ddebug(); }
 
@@ -191,39 +421,116 @@ class BPlusTree {
     }
   };
   struct Leaf {
-    int pos, nxt = 0;
+    int pos, prv = 0, nxt = 0;
     int num;
     std::pair<Key, Value> val[kLeafSize + 1];
     Leaf() {}
-    Leaf(int num, int pos, int nxt) {
+    Leaf(int num, int pos, int prv, int nxt) {
       memset(val, 0, sizeof(val));
       this->num = num;
       this->pos = pos;
+      this->prv = prv;
       this->nxt = nxt;
     }
-    void Set(int num, int pos, int nxt) {
+    void Set(int num, int pos, int prv, int nxt) {
       this->num = num;
       this->pos = pos;
+      this->prv = prv;
       this->nxt = nxt;
     }
   };
-  BufferPool<Internal, kInternalBufferSize> internal_pool;
-  BufferPool<Leaf, kLeafBufferSize> leaf_pool;
-  Internal root;
-  Leaf leaf;
+  using InternalPool = BufferPool<Internal, kInternalBufferSize>;
+  using LeafPool = BufferPool<Leaf, kLeafBufferSize>;
+  using InternalGuard = typename InternalPool::Guard;
+  using LeafGuard = typename LeafPool::Guard;
+
+ public:
+  /**
+   * Cursor points at one pair of the tree and moves along the leaf chain in
+   * either direction. It pins the leaf it is on, and only that one.
+   * Any change to the tree invalidates every cursor, so finish or drop the
+   * cursor before modifying.
+   */
+  class Cursor {
+   public:
+    Cursor() {}
+    /// False once the cursor has moved past either end of the tree.
+    bool Valid() const { return valid_; }
+    const std::pair<Key, Value>& operator*() const { return leaf_->val[pos_]; }
+    const std::pair<Key, Value>* operator->() const { return &leaf_->val[pos_]; }
+    void Next() {
+      while (++pos_ >= leaf_->num) {
+        if (!leaf_->nxt) return Invalidate();
+        leaf_ = tree_->FetchLeaf(leaf_->nxt);
+        pos_ = -1;
+      }
+    }
+    void Prev() {
+      while (--pos_ < 0) {
+        if (!leaf_->prv) return Invalidate();
+        leaf_ = tree_->FetchLeaf(leaf_->prv);
+        pos_ = leaf_->num;
+      }
+    }
+
+   private:
+    friend BPlusTree;
+    Cursor(BPlusTree* tree, LeafGuard&& leaf, int pos) : tree_(tree), leaf_(std::move(leaf)), pos_(pos) {}
+    void Invalidate() {
+      valid_ = false;
+      leaf_.Release();
+    }
+    BPlusTree* tree_ = nullptr;
+    LeafGuard leaf_;
+    int pos_ = 0;
+    bool valid_ = true;
+  };
+
+ private:
+  InternalPool internal_pool;
+  LeafPool leaf_pool;
+  int root_pos;
   int size;
   int last_leaf, last_internal;
-  const int INTSIZE = 2 * sizeof(int);
+  int free_leaf, free_internal;  // heads of the free lists, 0 if empty
+  int free_leaf_num, free_internal_num;
+  const int INTSIZE = 4 * sizeof(int);
+  static constexpr int kCompactMinLeaves = 64;
+  LogManager* log_ = nullptr;
+  int tree_file_id = -1, leaf_file_id = -1;
+
+  static int FileSize(std::fstream& file) {
+    file.seekg(0, std::ios::end);
+    return file.tellg();
+  }
+  void TreeHeader(int* header) {
+    header[0] = root_pos, header[1] = last_internal, header[2] = free_internal, header[3] = free_internal_num;
+  }
+  void LeafHeader(int* header) {
+    header[0] = last_leaf, header[1] = size, header[2] = free_leaf, header[3] = free_leaf_num;
+  }
+  void WriteHeaders() {
+    int header[4];
+    TreeHeader(header);
+    tree_file.seekp(0);
+    tree_file.write(reinterpret_cast<char*>(header), INTSIZE);
+    LeafHeader(header);
+    leaf_file.seekp(0);
+    leaf_file.write(reinterpret_cast<char*>(header), INTSIZE);
+  }
+  /// Turns redo logging of the changed nodes on or off.
+  void Track(bool on) {
+    internal_pool.Attach(on ? log_ : nullptr, tree_file_id);
+    leaf_pool.Attach(on ? log_ : nullptr, leaf_file_id);
+  }
 
-  void ddebug() { debug(root); }
+  void ddebug() { debug(root_pos); }
 
-  void debug(const Internal& internal) {
-    Print(internal);
-    if (internal.is_leaf) return;
-    for (int i = 0; i < internal.num; i++) {
-      Internal intt;
-      ReadInternal(intt, internal.son[i]);
-    }
+  void debug(int pos) {
+    InternalGuard internal = FetchInternal(pos);
+    Print(*internal);
+    if (internal->is_leaf) return;
+    for (int i = 0; i < internal->num; i++) debug(internal->son[i]);
   }
 
   void Print(const Internal& internal) {
@@ -242,219 +549,332 @@ class BPlusTree {
     std::cout << std::endl;
   }
 
-  bool InsertIfFatherSplit(const std::pair<Key, Value>& val, Internal& f) {
-    if (f.is_leaf) {
-      int pos = BinSearchInternalKey(val.first, f);
-      ReadLeaf(leaf, f.son[pos]);
+  /**
+   * How many nodes of capacity `max_size` BulkLoad() spreads `num` entries
+   * over: about `fill_factor` full, and never so many that the even split
+   * leaves a node under the half-full bound Remove() rebalances at. Only a
+   * single node, which becomes the root or its only child, may hold fewer.
+   */
+  static int BulkNodeCount(int num, int max_size, double fill_factor) {
+    int most = max_size - 1;  // a node splits once it is full
+    int least = max_size / 2 > 0 ? max_size / 2 : 1;
+    int per_node = static_cast<int>(fill_factor * most);
+    if (per_node < least) per_node = least;
+    if (per_node > most) per_node = most;
+    int nodes = (num + per_node - 1) / per_node;
+    // e.g. least + 1 entries would otherwise make two nodes of about least / 2
+    if (nodes > num / least) nodes = num / least;
+    return nodes > 0 ? nodes : 1;
+  }
+  int FirstLeaf() {
+    InternalGuard tmp = FetchInternal(root_pos);
+    while (!tmp->is_leaf) tmp = FetchInternal(tmp->son[0]);
+    return tmp->son[0];
+  }
+  /**
+   * Writes the `count` leaves of the chain to a new file at positions 1..count
+   * and puts it in place of the leaf file. Returns false, leaving the leaf
+   * file as it was, if any step fails.
+   */
+  bool WriteCompactedLeaves(int count) {
+    std::string new_filename = leaf_filename + ".new";
+    std::ofstream out(new_filename, std::ios::out | std::ios::trunc | std::ios::binary);
+    int header[4] = {count, size, 0, 0};
+    out.write(reinterpret_cast<char*>(header), INTSIZE);
+    int i = 0;
+    for (int pos = FirstLeaf(); pos && out;) {
+      LeafGuard leaf = FetchLeaf(pos);
+      Leaf copy = *leaf;
+      i++;
+      copy.Set(copy.num, i, i - 1, i < count ? i + 1 : 0);
+      out.seekp(static_cast<std::streamoff>(i) * sizeof(Leaf) + INTSIZE);
+      out.write(reinterpret_cast<char*>(&copy), sizeof(Leaf));
+      pos = leaf->nxt;
+    }
+    out.close();
+    bool ok = out && i == count && SyncFile(new_filename);
+    if (!ok || std::rename(new_filename.c_str(), leaf_filename.c_str()) != 0) {
+      std::cerr << "cannot compact " << leaf_filename << ": " << strerror(errno) << std::endl;
+      std::remove(new_filename.c_str());
+      return false;
+    }
+    size_t slash = leaf_filename.find_last_of('/');
+    SyncFile(slash == std::string::npos ? "." : leaf_filename.substr(0, slash));  // the rename itself
+    // the stream still refers to the old file, whose nodes the pool may also hold
+    leaf_file.close();
+    leaf_file.open(leaf_filename);
+    if (!leaf_file) FailIo("cannot open", leaf_filename);
+    return true;
+  }
+  /// Points the lowest internal level at the new leaf positions after Compact().
+  void RelinkLeaves(int pos, const lin::vector<int>& new_pos) {
+    InternalGuard internal = FetchInternal(pos);
+    for (int i = 0; i < internal->num; i++) {
+      if (internal->is_leaf)
+        internal->son[i] = new_pos[internal->son[i]];
+      else
+        RelinkLeaves(internal->son[i], new_pos);
+    }
+    if (internal->is_leaf) internal.MarkDirty();
+  }
+  /**
+   * Calls `fn(i, leaf, pos)` for each keys[i] that is present, visiting the
+   * keys in sorted order with one pinned leaf. See MultiGet().
+   */
+  template <class Fn>
+  void VisitKeys(const lin::vector<Key>& keys, Fn fn) {
+    if (keys.empty()) return;
+    lin::vector<int> order;
+    bool sorted = true;
+    for (size_t i = 0; i < keys.size(); i++) {
+      order.push_back(i);
+      if (i > 0 && keys[i] < keys[i - 1]) sorted = false;
+    }
+    if (!sorted) lin::Sort(order.begin(), order.end(), [&](int a, int b) { return keys[a] < keys[b]; });
+    LeafGuard leaf = FindLeaf(keys[order[0]]);
+    for (size_t i = 0; i < order.size(); i++) {
+      const Key& key = keys[order[i]];
+      if (leaf->num > 0 && leaf->val[leaf->num - 1].first < key && leaf->nxt) {
+        LeafGuard next = FetchLeaf(leaf->nxt);
+        if (next->num > 0 && key <= next->val[next->num - 1].first)
+          leaf = std::move(next);
+        else
+          leaf = FindLeaf(key);
+      }
+      int pos = BinSearchLeafKey(key, *leaf);
+      if (pos < leaf->num && leaf->val[pos].first == key) fn(order[i], leaf, pos);
+    }
+  }
+  /// Walks from the root down to the leaf that may contain `key`.
+  LeafGuard FindLeaf(const Key& key) {
+    InternalGuard tmp = FetchInternal(root_pos);
+    while (!tmp->is_leaf) {
+      int pos = BinSearchInternalKey(key, *tmp);
+      tmp = FetchInternal(tmp->son[pos]);
+    }
+    int pos_leaf = BinSearchInternalKey(key, *tmp);
+    return FetchLeaf(tmp->son[pos_leaf]);
+  }
+
+  /// Inserts `val`; if `assign` is true and the key exists, overwrites its value instead.
+  void InsertOrAssign(const std::pair<Key, Value>& val, bool assign) {
+    InternalGuard root = FetchInternal(root_pos);
+    if (InsertIfFatherSplit(val, root, assign)) {
+      int m = kInternalSize / 2;
+      InternalGuard new_brother = NewInternal(m, root->is_leaf);
+      InternalGuard new_root = NewInternal(2, false);
+
+      for (int i = 0; i < m; i++) new_brother->son[i] = root->son[m + i];
+      for (int i = 0; i < m - 1; i++) new_brother->key[i] = root->key[m + i];
+      root->num = m;
+      root.MarkDirty();
+
+      new_root->son[0] = root->pos;
+      new_root->son[1] = new_brother->pos;
+      new_root->key[0] = root->key[m - 1];
+      root_pos = new_root->pos;
+    }
+  }
+
+  bool InsertIfFatherSplit(const std::pair<Key, Value>& val, InternalGuard& f, bool assign) {
+    if (f->is_leaf) {
+      int pos = BinSearchInternalKey(val.first, *f);
+      LeafGuard leaf = FetchLeaf(f->son[pos]);
 
-      int pos_leaf = BinSearchLeafVal(val, leaf);
-      for (int i = leaf.num - 1; i >= pos_leaf; i--) leaf.val[i + 1] = leaf.val[i];
-      leaf.val[pos_leaf] = val;
-      leaf.num++;
+      int pos_leaf = BinSearchLeafVal(val, *leaf);
+      if (assign && pos_leaf < leaf->num && leaf->val[pos_leaf].first == val.first) {
+        leaf->val[pos_leaf].second = val.second;
+        leaf.MarkDirty();
+        return false;
+      }
+      for (int i = leaf->num - 1; i >= pos_leaf; i--) leaf->val[i + 1] = leaf->val[i];
+      leaf->val[pos_leaf] = val;
+      leaf->num++;
+      leaf.MarkDirty();
       size++;
-      if (leaf.num == kLeafSize) {
+      if (leaf->num == kLeafSize) {
         int m = kLeafSize / 2;
-        Leaf new_leaf(m, GetLeafIndex(), leaf.nxt);
-        for (int i = 0; i < m; i++) new_leaf.val[i] = leaf.val[i + m];
-        leaf.nxt = new_leaf.pos;
-        leaf.num = m;
-        WriteLeaf(leaf);
-        WriteLeaf(new_leaf);
-        for (int i = f.num - 1; i > pos; i--) f.son[i + 1] = f.son[i];
-        for (int i = f.num - 2; i >= pos; i--) f.key[i + 1] = f.key[i];
-        f.son[pos + 1] = new_leaf.pos;
-        f.key[pos] = leaf.val[m - 1].first;
-        f.num++;
-        if (f.num == kInternalSize)
-          return true;
-        else
-          WriteInternal(f);
-        return false;
-      } else {
-        WriteLeaf(leaf);
-        return false;
+        LeafGuard new_leaf = NewLeaf(m, leaf->pos, leaf->nxt);
+        for (int i = 0; i < m; i++) new_leaf->val[i] = leaf->val[i + m];
+        if (leaf->nxt) SetPrev(leaf->nxt, new_leaf->pos);
+        leaf->nxt = new_leaf->pos;
+        leaf->num = m;
+        for (int i = f->num - 1; i > pos; i--) f->son[i + 1] = f->son[i];
+        for (int i = f->num - 2; i >= pos; i--) f->key[i + 1] = f->key[i];
+        f->son[pos + 1] = new_leaf->pos;
+        f->key[pos] = leaf->val[m - 1].first;
+        f->num++;
+        f.MarkDirty();
+        return f->num == kInternalSize;
       }
+      return false;
     }
-    Internal son;
-    int pos = BinSearchInternalKey(val.first, f);
-    ReadInternal(son, f.son[pos]);
-    if (InsertIfFatherSplit(val, son)) {
+    int pos = BinSearchInternalKey(val.first, *f);
+    InternalGuard son = FetchInternal(f->son[pos]);
+    if (InsertIfFatherSplit(val, son, assign)) {
       int m = kInternalSize / 2;
-      Internal new_brother(m, GetInternalIndex(), son.is_leaf);
-      for (int i = 0; i < m; i++) new_brother.son[i] = son.son[m + i];
-      for (int i = 0; i < m - 1; i++) new_brother.key[i] = son.key[m + i];
-      son.num = m;
-      WriteInternal(son);
-      WriteInternal(new_brother);
-
-      for (int i = f.num - 1; i > pos; i--) f.son[i + 1] = f.son[i];
-      for (int i = f.num - 2; i >= pos; i--) f.key[i + 1] = f.key[i];
-      f.son[pos + 1] = new_brother.pos;
-      f.key[pos] = son.key[m - 1];
-      f.num++;
-
-      if (f.num == kInternalSize)
-        return true;
-      else
-        WriteInternal(f);
-      return false;
+      InternalGuard new_brother = NewInternal(m, son->is_leaf);
+      for (int i = 0; i < m; i++) new_brother->son[i] = son->son[m + i];
+      for (int i = 0; i < m - 1; i++) new_brother->key[i] = son->key[m + i];
+      son->num = m;
+      son.MarkDirty();
+
+      for (int i = f->num - 1; i > pos; i--) f->son[i + 1] = f->son[i];
+      for (int i = f->num - 2; i >= pos; i--) f->key[i + 1] = f->key[i];
+      f->son[pos + 1] = new_brother->pos;
+      f->key[pos] = son->key[m - 1];
+      f->num++;
+      f.MarkDirty();
+
+      return f->num == kInternalSize;
     } else
       return false;
   }
-  bool RemoveIfFatherMerge(const Key& key, Internal& f) {
-    if (f.is_leaf) {
-      int pos = BinSearchInternalKey(key, f);
-      ReadLeaf(leaf, f.son[pos]);
-      int pos_leaf = BinSearchLeafKey(key, leaf);
-
-      for (int i = pos_leaf; i < leaf.num - 1; i++) leaf.val[i] = leaf.val[i + 1];
-      leaf.num--;
+  bool RemoveIfFatherMerge(const Key& key, InternalGuard& f) {
+    if (f->is_leaf) {
+      int pos = BinSearchInternalKey(key, *f);
+      LeafGuard leaf = FetchLeaf(f->son[pos]);
+      int pos_leaf = BinSearchLeafKey(key, *leaf);
+
+      for (int i = pos_leaf; i < leaf->num - 1; i++) leaf->val[i] = leaf->val[i + 1];
+      leaf->num--;
+      leaf.MarkDirty();
       size--;
       int m = kLeafSize / 2;
-      if (leaf.num < m) {
-        Leaf sibilings_left, sibilings_right;
+      if (leaf->num < m) {
         if (pos > 0) {
-          ReadLeaf(sibilings_left, f.son[pos - 1]);
-          if (sibilings_left.num > m) {
-            for (int i = leaf.num - 1; i >= 0; i--) leaf.val[i + 1] = leaf.val[i];
-            leaf.val[0] = sibilings_left.val[sibilings_left.num - 1];
-            sibilings_left.num--;
-            leaf.num++;
-            f.key[pos - 1] = sibilings_left.val[sibilings_left.num - 1].first;
-
-            WriteLeaf(leaf);
-            WriteLeaf(sibilings_left);
-            WriteInternal(f);
+          LeafGuard sibilings_left = FetchLeaf(f->son[pos - 1]);
+          if (sibilings_left->num > m) {
+            for (int i = leaf->num - 1; i >= 0; i--) leaf->val[i + 1] = leaf->val[i];
+            leaf->val[0] = sibilings_left->val[sibilings_left->num - 1];
+            sibilings_left->num--;
+            leaf->num++;
+            f->key[pos - 1] = sibilings_left->val[sibilings_left->num - 1].first;
+
+            sibilings_left.MarkDirty();
+            f.MarkDirty();
             return false;
           }
         }
-        if (pos < f.num - 1) {
-          ReadLeaf(sibilings_right, f.son[pos + 1]);
-          if (sibilings_right.num > m) {
-            leaf.val[leaf.num] = sibilings_right.val[0];
-            for (int i = 0; i < sibilings_right.num - 1; i++) sibilings_right.val[i] = sibilings_right.val[i + 1];
-            leaf.num++;
-            sibilings_right.num--;
-            f.key[pos] = leaf.val[leaf.num - 1].first;
-
-            WriteLeaf(leaf);
-            WriteLeaf(sibilings_right);
-            WriteInternal(f);
+        if (pos < f->num - 1) {
+          LeafGuard sibilings_right = FetchLeaf(f->son[pos + 1]);
+          if (sibilings_right->num > m) {
+            leaf->val[leaf->num] = sibilings_right->val[0];
+            for (int i = 0; i < sibilings_right->num - 1; i++) sibilings_right->val[i] = sibilings_right->val[i + 1];
+            leaf->num++;
+            sibilings_right->num--;
+            f->key[pos] = leaf->val[leaf->num - 1].first;
+
+            sibilings_right.MarkDirty();
+            f.MarkDirty();
             return false;
           }
         }
         if (pos > 0) {
-          ReadLeaf(sibilings_left, f.son[pos - 1]);
-          for (int i = 0; i < leaf.num; i++) sibilings_left.val[sibilings_left.num + i] = leaf.val[i];
-          sibilings_left.num += leaf.num;
-          sibilings_left.nxt = leaf.nxt;
-          WriteLeaf(sibilings_left);
-          leaf_pool.Remove(leaf.pos);
-
-          for (int i = pos - 1; i < f.num - 2; i++) f.key[i] = f.key[i + 1];
-          for (int i = pos; i < f.num - 1; i++) f.son[i] = f.son[i + 1];
-          f.num--;
-
-          if (f.num < m) return true;
-          WriteInternal(f);
-          return false;
+          LeafGuard sibilings_left = FetchLeaf(f->son[pos - 1]);
+          for (int i = 0; i < leaf->num; i++) sibilings_left->val[sibilings_left->num + i] = leaf->val[i];
+          sibilings_left->num += leaf->num;
+          sibilings_left->nxt = leaf->nxt;
+          if (leaf->nxt) SetPrev(leaf->nxt, sibilings_left->pos);
+          sibilings_left.MarkDirty();
+          FreeLeaf(leaf);
+
+          for (int i = pos - 1; i < f->num - 2; i++) f->key[i] = f->key[i + 1];
+          for (int i = pos; i < f->num - 1; i++) f->son[i] = f->son[i + 1];
+          f->num--;
+          f.MarkDirty();
+
+          return f->num < m;
         }
-        if (pos < f.num - 1) {
-          ReadLeaf(sibilings_right, f.son[pos + 1]);
-          for (int i = 0; i < sibilings_right.num; i++) leaf.val[leaf.num + i] = sibilings_right.val[i];
-          leaf.num += sibilings_right.num;
-          leaf.nxt = sibilings_right.nxt;
-          WriteLeaf(leaf);
-          leaf_pool.Remove(sibilings_right.pos);
-
-          for (int i = pos; i < f.num - 2; i++) f.key[i] = f.key[i + 1];
-          for (int i = pos + 1; i < f.num - 1; i++) f.son[i] = f.son[i + 1];
-          f.num--;
-
-          if (f.num < m) return true;
-          WriteInternal(f);
-          return false;
+        if (pos < f->num - 1) {
+          LeafGuard sibilings_right = FetchLeaf(f->son[pos + 1]);
+          for (int i = 0; i < sibilings_right->num; i++) leaf->val[leaf->num + i] = sibilings_right->val[i];
+          leaf->num += sibilings_right->num;
+          leaf->nxt = sibilings_right->nxt;
+          if (leaf->nxt) SetPrev(leaf->nxt, leaf->pos);
+          FreeLeaf(sibilings_right);
+
+          for (int i = pos; i < f->num - 2; i++) f->key[i] = f->key[i + 1];
+          for (int i = pos + 1; i < f->num - 1; i++) f->son[i] = f->son[i + 1];
+          f->num--;
+          f.MarkDirty();
+
+          return f->num < m;
         }
-        WriteLeaf(leaf);
-      } else
-        WriteLeaf(leaf);
+      }
       return false;
     }
-    Internal son;
-    int pos = BinSearchInternalKey(key, f);
-    ReadInternal(son, f.son[pos]);
+    int pos = BinSearchInternalKey(key, *f);
+    InternalGuard son = FetchInternal(f->son[pos]);
     if (RemoveIfFatherMerge(key, son)) {
       int m = kInternalSize / 2;
-      Internal sibilings_left, sibilings_right;
       if (pos > 0) {
-        ReadInternal(sibilings_left, f.son[pos - 1]);
-        if (sibilings_left.num > m) {
-          for (int i = son.num - 1; i >= 0; i--) son.son[i + 1] = son.son[i];
-          for (int i = son.num - 2; i >= 0; i--) son.key[i + 1] = son.key[i];
-          son.son[0] = sibilings_left.son[sibilings_left.num - 1];
-          son.key[0] = f.key[pos - 1];
-          f.key[pos - 1] = sibilings_left.key[sibilings_left.num - 2];
-          sibilings_left.num--;
-          son.num++;
-
-          WriteInternal(son);
-          WriteInternal(sibilings_left);
-          WriteInternal(f);
+        InternalGuard sibilings_left = FetchInternal(f->son[pos - 1]);
+        if (sibilings_left->num > m) {
+          for (int i = son->num - 1; i >= 0; i--) son->son[i + 1] = son->son[i];
+          for (int i = son->num - 2; i >= 0; i--) son->key[i + 1] = son->key[i];
+          son->son[0] = sibilings_left->son[sibilings_left->num - 1];
+          son->key[0] = f->key[pos - 1];
+          f->key[pos - 1] = sibilings_left->key[sibilings_left->num - 2];
+          sibilings_left->num--;
+          son->num++;
+
+          son.MarkDirty();
+          sibilings_left.MarkDirty();
+          f.MarkDirty();
           return false;
         }
       }
-      if (pos < f.num - 1) {
-        ReadInternal(sibilings_right, f.son[pos + 1]);
-        if (sibilings_right.num > m) {
-          son.son[son.num] = sibilings_right.son[0];
-          son.key[son.num - 1] = f.key[pos];
-          f.key[pos] = sibilings_right.key[0];
+      if (pos < f->num - 1) {
+        InternalGuard sibilings_right = FetchInternal(f->son[pos + 1]);
+        if (sibilings_right->num > m) {
+          son->son[son->num] = sibilings_right->son[0];
+          son->key[son->num - 1] = f->key[pos];
+          f->key[pos] = sibilings_right->key[0];
           // To Be Checked
-          for (int i = 0; i < sibilings_right.num - 1; i++) sibilings_right.son[i] = sibilings_right.son[i + 1];
-          for (int i = 0; i < sibilings_right.num - 2; i++) sibilings_right.key[i] = sibilings_right.key[i + 1];
-          son.num++;
-          sibilings_right.num--;
-
-          WriteInternal(son);
-          WriteInternal(sibilings_right);
-          WriteInternal(f);
+          for (int i = 0; i < sibilings_right->num - 1; i++) sibilings_right->son[i] = sibilings_right->son[i + 1];
+          for (int i = 0; i < sibilings_right->num - 2; i++) sibilings_right->key[i] = sibilings_right->key[i + 1];
+          son->num++;
+          sibilings_right->num--;
+
+          son.MarkDirty();
+          sibilings_right.MarkDirty();
+          f.MarkDirty();
           return false;
         }
       }
       if (pos > 0) {
-        ReadInternal(sibilings_left, f.son[pos - 1]);
-        for (int i = 0; i < son.num; i++) sibilings_left.son[sibilings_left.num + i] = son.son[i];
-        sibilings_left.key[sibilings_left.num - 1] = f.key[pos - 1];
-        for (int i = 0; i < son.num - 1; i++) sibilings_left.key[sibilings_left.num + i] = son.key[i];
+        InternalGuard sibilings_left = FetchInternal(f->son[pos - 1]);
+        for (int i = 0; i < son->num; i++) sibilings_left->son[sibilings_left->num + i] = son->son[i];
+        sibilings_left->key[sibilings_left->num - 1] = f->key[pos - 1];
+        for (int i = 0; i < son->num - 1; i++) sibilings_left->key[sibilings_left->num + i] = son->key[i];
 
-        sibilings_left.num += son.num;
-        WriteInternal(sibilings_left);
-        internal_pool.Remove(son.pos);
+        sibilings_left->num += son->num;
+        sibilings_left.MarkDirty();
+        FreeInternal(son);
 
-        for (int i = pos - 1; i < f.num - 2; i++) f.key[i] = f.key[i + 1];
-        for (int i = pos; i < f.num - 1; i++) f.son[i] = f.son[i + 1];
-        f.num--;
+        for (int i = pos - 1; i < f->num - 2; i++) f->key[i] = f->key[i + 1];
+        for (int i = pos; i < f->num - 1; i++) f->son[i] = f->son[i + 1];
+        f->num--;
+        f.MarkDirty();
 
-        if (f.num < m) return true;
-        WriteInternal(f);
-        return false;
+        return f->num < m;
       }
-      if (pos < f.num - 1) {
-        ReadInternal(sibilings_right, f.son[pos + 1]);
-        for (int i = 0; i < sibilings_right.num; i++) son.son[son.num + i] = sibilings_right.son[i];
-        son.key[son.num - 1] = f.key[pos];
-        for (int i = 0; i < sibilings_right.num - 1; i++) son.key[son.num + i] = sibilings_right.key[i];
-        son.num += sibilings_right.num;
-        WriteInternal(son);
-        internal_pool.Remove(sibilings_right.pos);
-
-        for (int i = pos; i < f.num - 2; i++) f.key[i] = f.key[i + 1];
-        for (int i = pos + 1; i < f.num - 1; i++) f.son[i] = f.son[i + 1];
-        f.num--;
-
-        if (f.num < m) return true;
-        WriteInternal(f);
-        return false;
+      if (pos < f->num - 1) {
+        InternalGuard sibilings_right = FetchInternal(f->son[pos + 1]);
+        for (int i = 0; i < sibilings_right->num; i++) son->son[son->num + i] = sibilings_right->son[i];
+        son->key[son->num - 1] = f->key[pos];
+        for (int i = 0; i < sibilings_right->num - 1; i++) son->key[son->num + i] = sibilings_right->key[i];
+        son->num += sibilings_right->num;
+        son.MarkDirty();
+        FreeInternal(sibilings_right);
+
+        for (int i = pos; i < f->num - 2; i++) f->key[i] = f->key[i + 1];
+        for (int i = pos + 1; i < f->num - 1; i++) f->son[i] = f->son[i + 1];
+        f->num--;
+        f.MarkDirty();
+
+        return f->num < m;
       }
     }
     return false;
@@ -494,39 +914,56 @@ class BPlusTree {
     }
     return l + 1;
   }
-  void WriteInternal(const Internal& internal) {
-    auto ret = internal_pool.Insert(internal, internal.pos);
-    if (ret.first) {
-      tree_file.seekp(ret.second.pos * sizeof(Internal) + INTSIZE);
-      tree_file.write(reinterpret_cast<char*>(&ret.second), sizeof(Internal));
+  InternalGuard FetchInternal(int pos) { return internal_pool.Fetch(pos); }
+  LeafGuard FetchLeaf(int pos) { return leaf_pool.Fetch(pos); }
+  /// Allocates a new internal node and pins it, reusing a freed one if possible.
+  InternalGuard NewInternal(int num, bool is_leaf) {
+    InternalGuard internal;
+    if (free_internal) {
+      internal = FetchInternal(free_internal);
+      free_internal = internal->son[0];
+      free_internal_num--;
+      internal.MarkDirty();
+    } else {
+      internal = internal_pool.Create(++last_internal);
+      internal->pos = last_internal;
     }
+    internal->Set(num, internal->pos, is_leaf);
+    return internal;
   }
-  void WriteLeaf(const Leaf& leaf) {
-    auto ret = leaf_pool.Insert(leaf, leaf.pos);
-    if (ret.first) {
-      leaf_file.seekp(ret.second.pos * sizeof(Leaf) + INTSIZE);
-      leaf_file.write(reinterpret_cast<char*>(&ret.second), sizeof(Leaf));
+  LeafGuard NewLeaf(int num, int prv, int nxt) {
+    LeafGuard leaf;
+    if (free_leaf) {
+      leaf = FetchLeaf(free_leaf);
+      free_leaf = leaf->nxt;
+      free_leaf_num--;
+      leaf.MarkDirty();
+    } else {
+      leaf = leaf_pool.Create(++last_leaf);
+      leaf->pos = last_leaf;
     }
+    leaf->Set(num, leaf->pos, prv, nxt);
+    return leaf;
   }
-  void ReadInternal(Internal& internal, int pos) {
-    auto ret = internal_pool.Find(pos);
-    if (ret.first)
-      internal = ret.second;
-    else {
-      tree_file.seekg(pos * sizeof(Internal) + INTSIZE);
-      tree_file.read(reinterpret_cast<char*>(&internal), sizeof(Internal));
-    }
+  void SetPrev(int pos, int prv) {
+    LeafGuard leaf = FetchLeaf(pos);
+    leaf->prv = prv;
+    leaf.MarkDirty();
   }
-  void ReadLeaf(Leaf& leaf, int pos) {
-    auto ret = leaf_pool.Find(pos);
-    if (ret.first)
-      leaf = ret.second;
-    else {
-      leaf_file.seekg(pos * sizeof(Leaf) + INTSIZE);
-      leaf_file.read(reinterpret_cast<char*>(&leaf), sizeof(Leaf));
-    }
+  /// Puts a node that has been merged away on the free list.
+  void FreeInternal(InternalGuard& internal) {
+    internal->son[0] = free_internal;
+    free_internal = internal->pos;
+    free_internal_num++;
+    internal.MarkDirty();
+    internal.Release();
+  }
+  void FreeLeaf(LeafGuard& leaf) {
+    leaf->nxt = free_leaf;
+    free_leaf = leaf->pos;
+    free_leaf_num++;
+    leaf.MarkDirty();
+    leaf.Release();
   }
-  int GetInternalIndex() { return ++last_internal; }
-  int GetLeafIndex() { return ++last_leaf; }
 };
 }  // namespace huang
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "../lib/vector.h"
+#include "replacement_policy.hpp"
+
+namespace huang {
+
+/**
+ * What a buffer pool did with its frames, for BufferManager::Report().
+ */
+struct PoolStats {
+    uint64_t hits = 0, misses = 0;
+    uint64_t evictions = 0;  // frames reused within the pool
+    uint64_t given = 0;      // frames freed because another pool needed the memory
+    uint64_t taken = 0;      // frames allocated by freeing another pool's frame
+};
+
+/**
+ * A buffer pool as seen by the BufferManager.
+ */
+class ManagedPool {
+   public:
+    virtual ~ManagedPool() = default;
+    /** Gets the last-use tick of the frame the pool would evict next. Returns false if every frame is pinned. */
+    virtual bool OldestUnpinned(uint64_t &tick) = 0;
+    /** Writes back and frees the frame the pool would evict next. */
+    virtual void GiveUpFrame() = 0;
+    virtual size_t ResidentFrames() = 0;
+    PoolStats stats;
+    int priority = 0;
+};
+
+/**
+ * BufferManager shares one memory budget, in bytes, among the buffer pools of
+ * every tree in the process.
+ *
+ * A pool asks Grant() before allocating a frame. Within the budget the answer
+ * is always yes. Beyond it, the frame each pool would evict next is compared,
+ * lowest priority first and then least recently used: if the coldest one
+ * belongs to the asking pool, the pool reuses it; otherwise its owner frees it
+ * and the memory goes to the asking pool. So the trees that are used the most
+ * end up holding the most frames, and the internal nodes of a tree, whose
+ * pools have a higher priority, are not pushed out by its leaves. If every
+ * frame is pinned, pools may go over the budget.
+ *
+ * With a budget of 0, pools are not managed and each one keeps
+ * its own fixed number of frames.
+ */
+class BufferManager {
+   public:
+    static BufferManager &Instance() {
+        static BufferManager instance;
+        return instance;
+    }
+    BufferManager(const BufferManager &) = delete;
+    BufferManager &operator=(const BufferManager &) = delete;
+
+    /** Sets the budget; must be called before any tree is opened. */
+    void SetBudget(size_t bytes) { budget_ = bytes; }
+    bool Enabled() const { return budget_ > 0; }
+    /** Sets the replacement policy of the pools opened from now on, managed or not. */
+    void SetPolicy(ReplacerKind kind) { policy_ = kind; }
+    ReplacerKind Policy() const { return policy_; }
+    void Register(ManagedPool *pool, const std::string &name, size_t frame_size) {
+        pools_.push_back({pool, name, frame_size});
+    }
+    void Unregister(ManagedPool *pool) {
+        for (size_t i = 0; i < pools_.size(); i++)
+            if (pools_[i].pool == pool) {
+                used_ -= pool->ResidentFrames() * pools_[i].frame_size;
+                pools_.erase(i);
+                return;
+            }
+    }
+    /** A logical clock for the last use of frames, comparable across pools. */
+    uint64_t Tick() { return ++tick_; }
+    /**
+     * Returns true if `pool` may allocate one more frame of `bytes`, possibly
+     * after other pools gave up frames. Returns false if `pool` should reuse its
+     * own least recently used frame instead.
+     */
+    bool Grant(ManagedPool *pool, size_t bytes) {
+        while (used_ + bytes > budget_) {
+            ManagedPool *coldest = nullptr;
+            uint64_t coldest_tick = UINT64_MAX, tick;
+            for (size_t i = 0; i < pools_.size(); i++) {
+                ManagedPool *candidate = pools_[i].pool;
+                if (coldest && candidate->priority > coldest->priority) continue;
+                if (!candidate->OldestUnpinned(tick)) continue;
+                if (!coldest || candidate->priority < coldest->priority || tick < coldest_tick) {
+                    coldest_tick = tick;
+                    coldest = candidate;
+                }
+            }
+            if (!coldest) break;
+            if (coldest == pool) return false;
+            coldest->GiveUpFrame();
+            coldest->stats.given++;
+            pool->stats.taken++;
+        }
+        used_ += bytes;
+        return true;
+    }
+    /** Called by a pool that freed a frame of `bytes`. */
+    void Release(size_t bytes) { used_ -= bytes; }
+    /** One line per pool: resident frames and bytes, hit rate, and where frames came from and went to. */
+    std::string Report() {
+        std::string ret = "budget " + std::to_string(budget_) + " used " + std::to_string(used_) + '\n';
+        for (size_t i = 0; i < pools_.size(); i++) {
+            const Entry &entry = pools_[i];
+            const PoolStats &stats = entry.pool->stats;
+            uint64_t accesses = stats.hits + stats.misses;
+            size_t frames = entry.pool->ResidentFrames();
+            ret += entry.name + ": frames " + std::to_string(frames) + " bytes " +
+                   std::to_string(frames * entry.frame_size) + " hit " +
+                   std::to_string(accesses ? 100 * stats.hits / accesses : 0) + "% misses " +
+                   std::to_string(stats.misses) + " evictions " + std::to_string(stats.evictions) + " given " +
+                   std::to_string(stats.given) + " taken " + std::to_string(stats.taken) + '\n';
+        }
+        return ret;
+    }
+
+   private:
+    struct Entry {
+        ManagedPool *pool;
+        std::string name;
+        size_t frame_size;
+    };
+    BufferManager() {}
+    size_t budget_ = 0, used_ = 0;
+    ReplacerKind policy_ = ReplacerKind::kTwoQueue;
+    uint64_t tick_ = 0;
+    lin::vector<Entry> pools_;
+};
+
+}  // namespace huang
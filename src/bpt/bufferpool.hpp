@@ -1,44 +1,290 @@
 #pragma once
 
+#include <fstream>
 #include <utility>
 
+#include "../lib/vector.h"
+#include "buffer_manager.hpp"
+#include "flat_hashmap.hpp"
+#include "log_manager.hpp"
 #include "lru_replacer.hpp"
+#include "mmap_file.hpp"
+#include "two_queue_replacer.hpp"
 namespace huang {
+/**
+ * How a tree keeps its nodes in memory.
+ * - kBufferPool: a fixed number of frames filled with explicit reads and writes.
+ * - kMmap: the file is memory-mapped and the OS page cache does the caching.
+ */
+enum class StorageMode { kBufferPool, kMmap };
+
+/**
+ * BufferPool caches the nodes of one file in a fixed set of frames.
+ *
+ * Callers get a pointer into a resident frame through a Guard, which pins
+ * the frame until it is destroyed or released. A modified node is only
+ * marked dirty; it is written back to the file when its frame is evicted or
+ * when the pool is flushed. Node `pos` lives at byte `pos * sizeof(T) +
+ * offset` of the file.
+ *
+ * MAX is the number of frames kept for unpinned nodes. If every frame is
+ * pinned, the pool grows instead of failing. When the BufferManager has a
+ * budget, MAX is ignored and the pool grows and shrinks as the manager decides.
+ * Which frame is reused is up to the BufferManager's ReplacerKind.
+ *
+ * After Map(), the pool has no frames at all: a Guard simply points into the
+ * mapped file, and pinning, dirty bits and flushing are left to the OS.
+ *
+ * After Attach(), every page marked dirty stays pinned until WriteLog() has
+ * put its after-image into the redo log, so it is never written back first.
+ */
 template <class T, int MAX = 50>
-class BufferPool {
+class BufferPool : public ManagedPool {
    public:
-    std::pair<bool, T> Insert(const T& val, int pos) {
-        if (replacer.Size() >= MAX) {
-            int tmp;
-            T ret = replacer.Victim(tmp);
-            replacer.Insert(val, pos);
-            return std::make_pair(true, ret);
-        } else {
-            replacer.Insert(val, pos);
-            return std::make_pair(false, val);
+    /**
+     * Pins one frame of the pool. Movable, not copyable.
+     */
+    class Guard {
+       public:
+        Guard() {}
+        Guard(Guard &&other) noexcept : pool_(other.pool_), frame_(other.frame_), data_(other.data_) {
+            other.pool_ = nullptr;
+        }
+        Guard &operator=(Guard &&other) noexcept {
+            if (this != &other) {
+                Release();
+                pool_ = other.pool_, frame_ = other.frame_, data_ = other.data_;
+                other.pool_ = nullptr;
+            }
+            return *this;
+        }
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+        ~Guard() { Release(); }
+
+        T *operator->() const { return data_; }
+        T &operator*() const { return *data_; }
+        /** The node must be written back before its frame is reused. */
+        void MarkDirty() {
+            if (pool_) pool_->MarkDirty(frame_);
         }
+        /** Unpins the frame early. The guard must not be used afterwards. */
+        void Release() {
+            if (pool_) pool_->Unpin(frame_);
+            pool_ = nullptr;
+        }
+
+       private:
+        friend BufferPool;
+        Guard(BufferPool *pool, int frame) : pool_(pool), frame_(frame), data_(pool->frames_[frame].data) {}
+        explicit Guard(T *data) : data_(data) {}
+        BufferPool *pool_ = nullptr;
+        int frame_ = -1;
+        T *data_ = nullptr;
+    };
+
+    BufferPool() {}
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+    ~BufferPool() {
+        if (manager_) manager_->Unregister(this);
+        for (size_t i = 0; i < frames_.size(); i++) delete frames_[i].data;
+        delete replacer_;
     }
-    std::pair<bool, T> Find(int pos) {
-        try {
-            return std::make_pair(true, replacer.holder.at(pos));
-        } catch (...) {
-            return std::make_pair(false, T());
+    /** A pool of higher `priority` gives up frames to other pools only when no lower one can. */
+    void Open(std::fstream *file, const std::string &filename, int offset, int priority = 0) {
+        file_ = file;
+        filename_ = filename;
+        offset_ = offset;
+        this->priority = priority;
+        if (BufferManager::Instance().Policy() == ReplacerKind::kLru)
+            replacer_ = new LRUReplacer;
+        else
+            replacer_ = new TwoQueueReplacer;
+        if (BufferManager::Instance().Enabled()) {
+            manager_ = &BufferManager::Instance();
+            manager_->Register(this, filename_, sizeof(T));
         }
     }
+    /** Starts logging the changed pages as file `file_id` of `log`, or stops if `log` is null. */
+    void Attach(LogManager *log, int file_id) {
+        log_ = log;
+        file_id_ = file_id;
+    }
+    /** Switches the pool to StorageMode::kMmap. Returns false if the file cannot be mapped. */
+    bool Map() {
+        if (!mapping_.Open(filename_)) return false;
+        if (manager_) manager_->Unregister(this);
+        manager_ = nullptr;
+        return true;
+    }
+    /** Pins node `pos`, reading it from the file if it is not resident. */
+    Guard Fetch(int pos) {
+        if (mapping_.IsOpen()) return Guard(MappedNode(pos));
+        auto it = page_map_.find(pos);
+        if (it != page_map_.end()) {
+            stats.hits++;
+            Pin(it->second);
+            return Guard(this, it->second);
+        }
+        stats.misses++;
+        int frame = GetFrame(pos);
+        file_->seekg(static_cast<std::streamoff>(pos) * sizeof(T) + offset_);
+        file_->read(reinterpret_cast<char *>(frames_[frame].data), sizeof(T));
+        return Guard(this, frame);
+    }
+    /** Pins node `pos` without reading it from the file, the caller overwrites the whole node. */
+    Guard Create(int pos) {
+        if (mapping_.IsOpen()) {
+            size_t bytes = static_cast<size_t>(pos + 1) * sizeof(T) + offset_;
+            if (!mapping_.Reserve(bytes)) FailIo("cannot grow", filename_);
+            return Guard(MappedNode(pos));
+        }
+        int frame;
+        auto it = page_map_.find(pos);
+        if (it != page_map_.end()) {
+            frame = it->second;
+            Pin(frame);
+        } else {
+            frame = GetFrame(pos);
+        }
+        MarkDirty(frame);
+        return Guard(this, frame);
+    }
+    /** Drops a node that is no longer used. Its frame must not be pinned. */
     void Remove(int pos) {
-        try {
-            replacer.holder.erase(replacer.holder.find(pos));
-        } catch (...) {
+        auto it = page_map_.find(pos);
+        if (it == page_map_.end()) return;
+        int frame = it->second;
+        page_map_.erase(it);
+        replacer_->Forget(frame);
+        frames_[frame].dirty = false;
+        free_frames_.push_back(frame);
+    }
+    /**
+     * Forgets every cached node without writing it back, for when the file
+     * was replaced by a new one under the same name. Maps the new file if the
+     * old one was mapped. No node may be pinned.
+     */
+    void Reload() {
+        if (mapping_.IsOpen()) {
+            mapping_.Close();
+            if (!mapping_.Open(filename_)) FailIo("cannot map", filename_);
+            return;
         }
+        for (size_t i = 0; i < frames_.size(); i++) Remove(frames_[i].pos);
     }
-    T Pop() {
-        T ret = replacer.holder.begin()->second;
-        replacer.holder.erase(replacer.holder.begin());
-        return ret;
+    /** Appends the nodes changed since the last call to the redo log and unpins them. */
+    void WriteLog() {
+        for (size_t i = 0; i < pending_.size(); i++) {
+            Frame &frame = frames_[pending_[i]];
+            log_->Append(file_id_, static_cast<size_t>(frame.pos) * sizeof(T) + offset_, frame.data, sizeof(T));
+            frame.logging = false;
+            Unpin(pending_[i]);
+        }
+        pending_.clear();
+    }
+    bool OldestUnpinned(uint64_t &tick) override {
+        int frame;
+        if (!replacer_->Peek(frame)) return false;
+        tick = frames_[frame].last_used;
+        return true;
+    }
+    void GiveUpFrame() override {
+        int frame;
+        if (!replacer_->Victim(frame)) return;
+        Evict(frame);
+        delete frames_[frame].data;
+        frames_[frame].data = nullptr;
+        empty_slots_.push_back(frame);
+        manager_->Release(sizeof(T));
+    }
+    size_t ResidentFrames() override { return frames_.size() - empty_slots_.size(); }
+    /** Writes every dirty node back to the file. */
+    void FlushAll() {
+        for (size_t i = 0; i < frames_.size(); i++)
+            if (frames_[i].dirty) WriteBack(i);
     }
-    bool Empty() { return replacer.holder.empty(); }
 
    private:
-    Replacer<T, MAX> replacer;
+    struct Frame {
+        T *data;
+        int pos, pin;
+        uint64_t last_used;  // BufferManager tick of the last unpin
+        bool dirty;
+        bool logging;  // changed in the current group of the redo log, and pinned until it is logged
+    };
+    std::fstream *file_ = nullptr;
+    std::string filename_;
+    int offset_ = 0;
+    MmapFile mapping_;
+    lin::vector<Frame> frames_;
+    lin::vector<int> free_frames_;
+    lin::vector<int> empty_slots_;  // frames whose memory was given back to the BufferManager
+    BufferManager *manager_ = nullptr;
+    flat_hashmap<int, int> page_map_;  // pos -> frame
+    ReplacementPolicy *replacer_ = nullptr;
+    LogManager *log_ = nullptr;
+    int file_id_ = -1;
+    lin::vector<int> pending_;  // frames with `logging` set
+
+    T *MappedNode(int pos) {
+        return reinterpret_cast<T *>(mapping_.Data() + static_cast<size_t>(pos) * sizeof(T) + offset_);
+    }
+    void Pin(int frame) {
+        if (frames_[frame].pin++ == 0) replacer_->Pin(frame);
+    }
+    void Unpin(int frame) {
+        if (--frames_[frame].pin == 0) {
+            if (manager_) frames_[frame].last_used = manager_->Tick();
+            replacer_->Unpin(frame);
+        }
+    }
+    void MarkDirty(int frame) {
+        frames_[frame].dirty = true;
+        if (log_ && !frames_[frame].logging) {
+            frames_[frame].logging = true;
+            Pin(frame);
+            pending_.push_back(frame);
+            log_->AddPending();
+        }
+    }
+    void WriteBack(int frame) {
+        file_->seekp(static_cast<std::streamoff>(frames_[frame].pos) * sizeof(T) + offset_);
+        file_->write(reinterpret_cast<char *>(frames_[frame].data), sizeof(T));
+        frames_[frame].dirty = false;
+    }
+    /** Drops the node held by an unpinned frame, writing it back first if needed. */
+    void Evict(int frame) {
+        if (frames_[frame].dirty) WriteBack(frame);
+        page_map_.erase(page_map_.find(frames_[frame].pos));
+    }
+    /** Finds a frame for node `pos` and pins it. */
+    int GetFrame(int pos) {
+        int frame;
+        if (!free_frames_.empty()) {
+            frame = free_frames_[free_frames_.size() - 1];
+            free_frames_.pop_back();
+        } else if ((manager_ ? !manager_->Grant(this, sizeof(T)) : static_cast<int>(frames_.size()) >= MAX) &&
+                   replacer_->Victim(frame)) {
+            stats.evictions++;
+            Evict(frame);
+        } else if (!empty_slots_.empty()) {
+            frame = empty_slots_[empty_slots_.size() - 1];
+            empty_slots_.pop_back();
+            frames_[frame].data = new T;
+        } else {
+            frame = frames_.size();
+            frames_.push_back({new T, 0, 0, 0, false, false});
+            replacer_->Resize(frame + 1);
+        }
+        replacer_->Admit(frame, pos);
+        frames_[frame].pos = pos;
+        frames_[frame].pin = 1;
+        frames_[frame].dirty = false;
+        frames_[frame].logging = false;
+        page_map_[pos] = frame;
+        return frame;
+    }
 };
-}  // namespace huang
\ No newline at end of file
+}  // namespace huang
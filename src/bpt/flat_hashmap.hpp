@@ -0,0 +1,238 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <utility>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace huang {
+
+/**
+ * flat_hashmap is an open-addressing hash map that keeps all entries in one
+ * array, in the style of Swiss tables.
+ *
+ * Beside the entries there is one control byte per slot: empty, deleted, or
+ * 7 bits of the hash of the key it holds. A lookup loads 16 control bytes at
+ * once and compares them with the key's 7 bits in a single SIMD instruction
+ * (with a scalar fallback), so it seldom compares a key that does not match.
+ * The capacity is a power of two and the table grows at 7/8 full.
+ *
+ * With Ordered, the entries are also linked in insertion order through slot
+ * indices: begin() is the oldest entry, as in linked_hashmap. Otherwise the
+ * iteration order is unspecified.
+ *
+ * Any insertion may move entries and invalidates iterators and references.
+ */
+template <class Key, class T, class Hash = std::hash<Key>, class Equal = std::equal_to<Key>, bool Ordered = false>
+class flat_hashmap {
+   public:
+    typedef std::pair<const Key, T> value_type;
+
+    class iterator {
+       public:
+        iterator() {}
+        value_type &operator*() const { return map_->slots_[index_]; }
+        value_type *operator->() const { return &map_->slots_[index_]; }
+        iterator &operator++() {
+            index_ = map_->NextIndex(index_);
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        bool operator==(const iterator &rhs) const { return index_ == rhs.index_; }
+        bool operator!=(const iterator &rhs) const { return index_ != rhs.index_; }
+
+       private:
+        friend flat_hashmap;
+        iterator(flat_hashmap *map, size_t index) : map_(map), index_(index) {}
+        flat_hashmap *map_ = nullptr;
+        size_t index_ = 0;  // capacity_ is end()
+    };
+
+    flat_hashmap() {}
+    flat_hashmap(const flat_hashmap &) = delete;
+    flat_hashmap &operator=(const flat_hashmap &) = delete;
+    ~flat_hashmap() {
+        clear();
+        Deallocate();
+    }
+
+    iterator begin() {
+        if (Ordered) return iterator(this, capacity_ ? next_[capacity_] : 0);
+        return iterator(this, capacity_ ? NextFull(0) : 0);
+    }
+    iterator end() { return iterator(this, capacity_); }
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    iterator find(const Key &key) { return iterator(this, Find(key, Mix(Hash()(key)))); }
+    size_t count(const Key &key) { return find(key) != end(); }
+    T &operator[](const Key &key) { return insert(value_type(key, T())).first->second; }
+    /** Inserts `value` unless its key is present. Returns the entry of the key and whether it was inserted. */
+    std::pair<iterator, bool> insert(const value_type &value) {
+        size_t hash = Mix(Hash()(value.first));
+        size_t index = Find(value.first, hash);
+        if (index != capacity_) return {iterator(this, index), false};
+        if ((size_ + deleted_ + 1) * 8 > capacity_ * 7) Rehash(size_ + 1 > capacity_ * 7 / 16 ? capacity_ * 2 : capacity_);
+        index = FindSlot(hash);
+        if (ctrl_[index] == kDeleted) --deleted_;
+        SetCtrl(index, static_cast<int8_t>(hash & 0x7F));
+        new (&slots_[index]) value_type(value);
+        if (Ordered) Link(index);
+        ++size_;
+        return {iterator(this, index), true};
+    }
+    void erase(iterator pos) {
+        size_t index = pos.index_;
+        slots_[index].~value_type();
+        SetCtrl(index, kDeleted);
+        if (Ordered) Unlink(index);
+        --size_;
+        ++deleted_;
+    }
+    void clear() {
+        size_ = deleted_ = 0;
+        if (capacity_ == 0) return;
+        for (size_t i = 0; i < capacity_; i++)
+            if (ctrl_[i] >= 0) slots_[i].~value_type();
+        for (size_t i = 0; i < capacity_ + kGroupWidth; i++) ctrl_[i] = kEmpty;
+        if (Ordered) next_[capacity_] = prev_[capacity_] = capacity_;
+    }
+
+   private:
+    static constexpr int8_t kEmpty = -128, kDeleted = -2;  // a full slot has a control byte in [0, 128)
+    static constexpr size_t kGroupWidth = 16;
+
+    /** A bit mask over 16 control bytes starting at any slot. */
+    struct Group {
+#ifdef __SSE2__
+        explicit Group(const int8_t *ctrl) : bytes(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl))) {}
+        uint32_t Match(int8_t h2) const { return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), bytes)); }
+        uint32_t MatchEmpty() const { return Match(kEmpty); }
+        uint32_t MatchFree() const { return _mm_movemask_epi8(bytes); }
+        __m128i bytes;
+#else
+        explicit Group(const int8_t *ctrl) : bytes(ctrl) {}
+        uint32_t Match(int8_t h2) const {
+            uint32_t mask = 0;
+            for (size_t i = 0; i < kGroupWidth; i++) mask |= static_cast<uint32_t>(bytes[i] == h2) << i;
+            return mask;
+        }
+        uint32_t MatchEmpty() const { return Match(kEmpty); }
+        uint32_t MatchFree() const {
+            uint32_t mask = 0;
+            for (size_t i = 0; i < kGroupWidth; i++) mask |= static_cast<uint32_t>(bytes[i] < 0) << i;
+            return mask;
+        }
+        const int8_t *bytes;
+#endif
+    };
+
+    // ctrl_[capacity_ + i] repeats ctrl_[i] for i < kGroupWidth, so a group may start at any slot
+    int8_t *ctrl_ = nullptr;
+    value_type *slots_ = nullptr;
+    uint32_t *prev_ = nullptr, *next_ = nullptr;  // insertion order when Ordered; slot capacity_ is the sentinel
+    size_t capacity_ = 0, size_ = 0, deleted_ = 0;
+
+    /** Spreads the bits of a hash that may be the key itself. */
+    static size_t Mix(size_t hash) {
+        uint64_t x = hash;
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return x;
+    }
+    /** Returns the slot holding `key`, whose mixed hash is `hash`, or capacity_. */
+    size_t Find(const Key &key, size_t hash) {
+        if (size_ == 0) return capacity_;
+        size_t mask = capacity_ - 1, pos = (hash >> 7) & mask;
+        for (size_t step = kGroupWidth;; step += kGroupWidth) {
+            Group group(ctrl_ + pos);
+            for (uint32_t match = group.Match(static_cast<int8_t>(hash & 0x7F)); match; match &= match - 1) {
+                size_t index = (pos + __builtin_ctz(match)) & mask;
+                if (Equal()(slots_[index].first, key)) return index;
+            }
+            if (group.MatchEmpty()) return capacity_;
+            pos = (pos + step) & mask;
+        }
+    }
+    /** Returns the first empty or deleted slot on the probe sequence of `hash`. */
+    size_t FindSlot(size_t hash) {
+        size_t mask = capacity_ - 1, pos = (hash >> 7) & mask;
+        for (size_t step = kGroupWidth;; step += kGroupWidth) {
+            uint32_t free = Group(ctrl_ + pos).MatchFree();
+            if (free) return (pos + __builtin_ctz(free)) & mask;
+            pos = (pos + step) & mask;
+        }
+    }
+    void SetCtrl(size_t index, int8_t ctrl) {
+        ctrl_[index] = ctrl;
+        if (index < kGroupWidth) ctrl_[capacity_ + index] = ctrl;
+    }
+    size_t NextFull(size_t index) {
+        while (index < capacity_ && ctrl_[index] < 0) index++;
+        return index;
+    }
+    size_t NextIndex(size_t index) { return Ordered ? next_[index] : NextFull(index + 1); }
+    void Link(size_t index) {
+        prev_[index] = prev_[capacity_];
+        next_[index] = capacity_;
+        next_[prev_[capacity_]] = index;
+        prev_[capacity_] = index;
+    }
+    void Unlink(size_t index) {
+        next_[prev_[index]] = next_[index];
+        prev_[next_[index]] = prev_[index];
+    }
+    /** Moves every entry into a table of `capacity` slots, dropping the deleted ones. */
+    void Rehash(size_t capacity) {
+        if (capacity < kGroupWidth) capacity = kGroupWidth;
+        int8_t *old_ctrl = ctrl_;
+        value_type *old_slots = slots_;
+        uint32_t *old_next = next_;
+        uint32_t *old_prev = prev_;
+        size_t old_capacity = capacity_;
+        capacity_ = capacity;
+        ctrl_ = new int8_t[capacity_ + kGroupWidth];
+        slots_ = static_cast<value_type *>(::operator new(sizeof(value_type) * capacity_));
+        if (Ordered) {
+            next_ = new uint32_t[capacity_ + 1];
+            prev_ = new uint32_t[capacity_ + 1];
+        }
+        for (size_t i = 0; i < capacity_ + kGroupWidth; i++) ctrl_[i] = kEmpty;
+        if (Ordered) next_[capacity_] = prev_[capacity_] = capacity_;
+        deleted_ = 0;
+        // an ordered table is refilled in insertion order
+        size_t i = Ordered && old_capacity ? old_next[old_capacity] : 0;
+        while (i < old_capacity) {
+            if (old_ctrl[i] >= 0) {
+                size_t index = FindSlot(Mix(Hash()(old_slots[i].first)));
+                SetCtrl(index, old_ctrl[i]);
+                new (&slots_[index]) value_type(std::move(old_slots[i]));
+                old_slots[i].~value_type();
+                if (Ordered) Link(index);
+            }
+            i = Ordered ? old_next[i] : i + 1;
+        }
+        delete[] old_ctrl;
+        ::operator delete(old_slots);
+        delete[] old_next;
+        delete[] old_prev;
+    }
+    void Deallocate() {
+        delete[] ctrl_;
+        ::operator delete(slots_);
+        delete[] next_;
+        delete[] prev_;
+    }
+};
+
+}  // namespace huang
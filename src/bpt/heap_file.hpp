@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "log_manager.hpp"
+#include "mmap_file.hpp"
+
+namespace huang {
+
+/**
+ * HeapFile keeps variable-length records back to back in one memory-mapped
+ * file, so that a B+ tree can hold a small (offset, length) reference instead
+ * of a large value.
+ *
+ * Records are appended at 8-byte aligned offsets and never change or move,
+ * so the pointer Get() returns stays valid for the lifetime of the HeapFile.
+ * The first kHeaderSize bytes of the file hold the offset of the first unused
+ * byte. Space of records that are no longer referenced is not reused.
+ *
+ * With the redo log enabled, the bytes appended since the last commit are
+ * logged with it. Appends the log does not know about yet may reach the file
+ * early, which is harmless: nothing refers to them after a crash.
+ */
+class HeapFile : public LogClient {
+   public:
+    static constexpr size_t kHeaderSize = sizeof(uint64_t);
+
+    explicit HeapFile(const std::string &filename) : filename_(filename) {
+        // Every record lives in the mapping, there is nothing to fall back to.
+        if (!file_.Open(filename_)) FailIo("cannot map", filename_);
+        if (file_.Size() >= kHeaderSize) memcpy(&end_, file_.Data(), kHeaderSize);
+        if (end_ < kHeaderSize || end_ > file_.Size()) {
+            end_ = kHeaderSize;
+            if (!file_.Reserve(end_)) FailIo("cannot grow", filename_);
+        }
+        logged_end_ = end_;
+        if (LogManager::Instance().Enabled()) {
+            log_ = &LogManager::Instance();
+            log_->Register(this);
+            file_id_ = log_->AddFile(filename_);
+        }
+    }
+    HeapFile(const HeapFile &) = delete;
+    HeapFile &operator=(const HeapFile &) = delete;
+    ~HeapFile() {
+        if (log_) {
+            log_->Checkpoint();
+            log_->Unregister(this);
+        }
+        WriteHeader();
+    }
+
+    /** Stores `len` bytes and returns the offset to read them back from. */
+    size_t Append(const void *data, size_t len) {
+        size_t offset = (end_ + 7) & ~static_cast<size_t>(7);
+        if (!file_.Reserve(offset + len)) FailIo("cannot grow", filename_);
+        memcpy(file_.Data() + offset, data, len);
+        end_ = offset + len;
+        if (log_) log_->AddPending();
+        return offset;
+    }
+    /** Returns the record stored at `offset`. */
+    const char *Get(size_t offset) const { return file_.Data() + offset; }
+    /** The offset just past the last record; the first record is at kHeaderSize. */
+    size_t End() const { return end_; }
+
+    void WriteLog(LogManager &log) override {
+        if (logged_end_ == end_) return;
+        log.Append(file_id_, logged_end_, file_.Data() + logged_end_, end_ - logged_end_);
+        log.Append(file_id_, 0, &end_, kHeaderSize);
+        logged_end_ = end_;
+    }
+    void Flush() override {
+        WriteHeader();
+        file_.Sync(end_);
+    }
+
+   private:
+    std::string filename_;
+    MmapFile file_;
+    uint64_t end_ = 0;         // first unused byte
+    uint64_t logged_end_ = 0;  // bytes before this are in the redo log or the file
+    LogManager *log_ = nullptr;
+    int file_id_ = -1;
+
+    void WriteHeader() {
+        if (file_.IsOpen()) memcpy(file_.Data(), &end_, kHeaderSize);
+    }
+};
+
+}  // namespace huang
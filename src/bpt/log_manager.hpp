@@ -0,0 +1,277 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "../lib/vector.h"
+
+namespace huang {
+
+/**
+ * How much a finished command is protected against a crash.
+ * - kNone: no redo log; changes reach the files only when the trees are closed.
+ * - kAsync: every group is handed to the OS, but never fsync'd. Survives a killed
+ *   process, not a power loss.
+ * - kGroup: one fsync per group of commands; up to a group of commands may be lost.
+ * - kSync: one fsync per command.
+ */
+enum class Durability { kNone, kAsync, kGroup, kSync };
+
+class LogManager;
+
+/**
+ * A tree or heap file whose pages go through the redo log.
+ */
+class LogClient {
+   public:
+    virtual ~LogClient() = default;
+    /** Appends the after-image of every page changed since the last call, and the file headers. */
+    virtual void WriteLog(LogManager &log) = 0;
+    /** Writes everything to the data files and fsyncs them. */
+    virtual void Flush() = 0;
+};
+
+/** Waits until the contents of `filename` are on disk. Returns false if they may not be. */
+inline bool SyncFile(const std::string &filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = fdatasync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+/**
+ * LogManager keeps one physical redo log shared by every tree of the process.
+ *
+ * Pages changed by a group of commands stay pinned in their buffer pools
+ * until the group is committed: then the after-image of each changed page is
+ * appended to the log once, followed by a commit record with a checksum, and
+ * the log is fsync'd according to the durability level. Only after that may a
+ * page be written back to its data file, so the data files never hold a change
+ * the log does not.
+ *
+ * On Open(), the committed groups of an existing log are written into the data
+ * files, which brings every tree to its state at the last commit. Once the log
+ * grows past kCheckpointBytes, every tree is flushed and the log starts over.
+ */
+class LogManager {
+   public:
+    static constexpr int kDefaultGroupSize = 256;
+    static constexpr int kMaxPendingPages = 4096;  // commit early if a group touches this many pages
+    static constexpr size_t kCheckpointBytes = 1UL << 28;
+
+    /** The log shared by the whole process. */
+    static LogManager &Instance() {
+        static LogManager instance;
+        return instance;
+    }
+    LogManager(const LogManager &) = delete;
+    LogManager &operator=(const LogManager &) = delete;
+    ~LogManager() { Close(); }
+
+    /**
+     * Replays `filename` into the data files and starts logging to it.
+     * Must be called before any tree is opened. With Durability::kNone nothing is logged.
+     */
+    void Open(const std::string &filename, Durability level, int group_size = kDefaultGroupSize) {
+        level_ = level;
+        group_size_ = group_size > 0 ? group_size : 1;
+        if (level_ == Durability::kNone) return;
+        fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0) {
+            level_ = Durability::kNone;
+            return;
+        }
+        Recover();
+    }
+    bool Enabled() const { return fd_ >= 0; }
+
+    /** Adds a client, which is asked for its changes at every commit. */
+    void Register(LogClient *client) { clients_.push_back(client); }
+    /** Names a data file in the log from now on. Returns the id that Append() takes. */
+    int AddFile(const std::string &filename) {
+        files_.push_back(filename);
+        return files_.size() - 1;
+    }
+    /** Removes a client. Its changes must already be in its files. */
+    void Unregister(LogClient *client) {
+        for (size_t i = 0; i < clients_.size(); i++)
+            if (clients_[i] == client) {
+                clients_.erase(i);
+                return;
+            }
+    }
+    /** Called by a buffer pool when a page becomes part of the current group. */
+    void AddPending() { ++pending_pages_; }
+    /** Appends the after-image of `len` bytes at `offset` of file `file_id` to the current group. */
+    void Append(int file_id, size_t offset, const void *data, size_t len) {
+        AppendRecord({kPage, static_cast<uint32_t>(file_id), offset, static_cast<uint32_t>(len)}, data);
+    }
+    /** Marks the end of a command, which may complete a group. */
+    void EndCommand() {
+        if (!Enabled() || pending_pages_ == 0) return;
+        if (level_ == Durability::kSync || ++commands_ >= group_size_ || pending_pages_ >= kMaxPendingPages)
+            Commit();
+    }
+    /**
+     * Commits early if the current group holds too many pages. Long commands
+     * call this where their trees are consistent; such a command is no longer
+     * atomic across a crash.
+     */
+    void CommitIfFull() {
+        if (pending_pages_ >= kMaxPendingPages) Commit();
+    }
+    /** Logs the current group, however small. */
+    void Commit() {
+        if (!Enabled() || pending_pages_ == 0) return;
+        // a fresh log names every file again, otherwise only the files added since the last group
+        if (log_size_ == 0) named_ = 0;
+        for (; named_ < files_.size(); named_++)
+            AppendRecord({kName, static_cast<uint32_t>(named_), 0, static_cast<uint32_t>(files_[named_].size())},
+                         files_[named_].data());
+        for (size_t i = 0; i < clients_.size(); i++) clients_[i]->WriteLog(*this);
+        AppendRecord({kCommit, 0, checksum_, 0}, nullptr);
+        if (!WriteAll(fd_, buffer_.data(), buffer_.size(), log_size_) ||
+            (level_ != Durability::kAsync && fdatasync(fd_) != 0))
+            Fail("cannot write the redo log");
+        log_size_ += buffer_.size();
+        buffer_.clear();
+        checksum_ = kChecksumSeed;
+        pending_pages_ = commands_ = 0;
+        if (log_size_ >= kCheckpointBytes) Checkpoint();
+    }
+    /** Writes every tree to its files and empties the log. */
+    void Checkpoint() {
+        if (!Enabled()) return;
+        Commit();
+        for (size_t i = 0; i < clients_.size(); i++) clients_[i]->Flush();
+        if (ftruncate(fd_, 0) == 0) fdatasync(fd_);
+        log_size_ = 0;
+    }
+    void Close() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+    }
+
+   private:
+    enum RecordType : uint32_t { kName = 1, kPage = 2, kCommit = 3 };
+    /** A record is this header followed by `len` bytes. A commit record keeps the checksum in `offset`. */
+    struct RecordHeader {
+        uint32_t type, file_id;
+        uint64_t offset;
+        uint32_t len, pad = 0;
+    };
+    static constexpr uint64_t kChecksumSeed = 14695981039346656037UL;
+
+    LogManager() {}
+
+    int fd_ = -1;
+    Durability level_ = Durability::kNone;
+    int group_size_ = kDefaultGroupSize;
+    int commands_ = 0, pending_pages_ = 0;
+    size_t log_size_ = 0;
+    size_t named_ = 0;  // files_[0, named_) are named in the log
+    uint64_t checksum_ = kChecksumSeed;
+    std::string buffer_;
+    lin::vector<std::string> files_;
+    lin::vector<LogClient *> clients_;
+
+    /** FNV-1a style hash over every byte of a group except its commit record, 8 bytes at a time. */
+    static uint64_t Checksum(uint64_t hash, const char *data, size_t len) {
+        constexpr uint64_t kPrime = 1099511628211UL;
+        size_t i = 0;
+        for (uint64_t word; i + 8 <= len; i += 8) {
+            memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * kPrime;
+        }
+        for (; i < len; i++) hash = (hash ^ static_cast<unsigned char>(data[i])) * kPrime;
+        return hash;
+    }
+    void AppendRecord(const RecordHeader &header, const void *data) {
+        const char *bytes = reinterpret_cast<const char *>(&header);
+        buffer_.append(bytes, sizeof(header));
+        if (header.len) buffer_.append(static_cast<const char *>(data), header.len);
+        if (header.type != kCommit) {
+            checksum_ = Checksum(checksum_, bytes, sizeof(header));
+            checksum_ = Checksum(checksum_, static_cast<const char *>(data), header.len);
+        }
+    }
+    /**
+     * The clients unpin a group's pages as they log them, so a group that did not
+     * reach the log cannot be held back from the data files any more. Stop before
+     * any of its pages is written back: recovery replays the groups before it and
+     * drops its torn tail by the checksum.
+     */
+    [[noreturn]] static void Fail(const char *what) {
+        perror(what);
+        std::abort();
+    }
+    static bool WriteAll(int fd, const char *data, size_t len, size_t offset) {
+        while (len > 0) {
+            ssize_t n = pwrite(fd, data, len, offset);
+            if (n <= 0) return false;
+            data += n, len -= n, offset += n;
+        }
+        return true;
+    }
+    /** Applies every complete group of the log to the data files, then empties the log. */
+    void Recover() {
+        off_t size = lseek(fd_, 0, SEEK_END);
+        if (size <= 0) return;
+        std::string log(size, '\0');
+        if (pread(fd_, log.data(), size, 0) != size) return;
+        lin::vector<std::string> names;
+        lin::vector<int> fds;
+        size_t pos = 0, group_begin = 0;
+        uint64_t checksum = kChecksumSeed;
+        while (pos + sizeof(RecordHeader) <= log.size()) {
+            RecordHeader header;
+            memcpy(&header, log.data() + pos, sizeof(header));
+            if (pos + sizeof(header) + header.len > log.size()) break;
+            if (header.type == kCommit) {
+                if (header.offset != checksum) break;
+                Replay(log, group_begin, pos, names, fds);
+                group_begin = pos + sizeof(header);
+                checksum = kChecksumSeed;
+            } else {
+                checksum = Checksum(checksum, log.data() + pos, sizeof(header));
+                checksum = Checksum(checksum, log.data() + pos + sizeof(header), header.len);
+            }
+            pos += sizeof(header) + header.len;
+        }
+        for (size_t i = 0; i < fds.size(); i++)
+            if (fds[i] >= 0) {
+                fdatasync(fds[i]);
+                ::close(fds[i]);
+            }
+        if (ftruncate(fd_, 0) == 0) fdatasync(fd_);
+    }
+    /** Writes the records in log[begin, end) of one committed group to the data files. */
+    static void Replay(const std::string &log, size_t begin, size_t end, lin::vector<std::string> &names,
+                       lin::vector<int> &fds) {
+        for (size_t pos = begin; pos < end;) {
+            RecordHeader header;
+            memcpy(&header, log.data() + pos, sizeof(header));
+            const char *data = log.data() + pos + sizeof(header);
+            pos += sizeof(header) + header.len;
+            while (names.size() <= header.file_id) {
+                names.push_back("");
+                fds.push_back(-1);
+            }
+            if (header.type == kName) {
+                names[header.file_id].assign(data, header.len);
+            } else if (header.type == kPage && !names[header.file_id].empty()) {
+                if (fds[header.file_id] < 0) fds[header.file_id] = ::open(names[header.file_id].c_str(), O_RDWR | O_CREAT, 0644);
+                if (fds[header.file_id] >= 0) WriteAll(fds[header.file_id], data, header.len, header.offset);
+            }
+        }
+    }
+};
+
+}  // namespace huang
@@ -1,34 +1,71 @@
 #pragma once
 
-#include "linked_hashmap.hpp"
+#include "../lib/vector.h"
+#include "replacement_policy.hpp"
 
 namespace huang {
 
 /**
  * LRUReplacer implements the Least Recently Used replacement policy.
+ *
+ * It tracks buffer pool frames by index. Only unpinned frames are candidates
+ * for eviction; a frame becomes the most recently used one every time it is
+ * unpinned, so plain reads refresh it as well as writes.
  */
-template <typename T, int MAX = 50>
-class Replacer {
+class LRUReplacer : public ReplacementPolicy {
    public:
-    Replacer(){};
-    ~Replacer(){};
-    void Insert(const T &value, int pos) {
-        try {
-            holder.erase(holder.find(pos));
-        } catch (...) {
+    LRUReplacer() {
+        // frame -1 is the sentinel of the circular list
+        prev_.push_back(-1);
+        next_.push_back(-1);
+    }
+    /** New frames start pinned. */
+    void Resize(int num) override {
+        while (Capacity() < num) {
+            prev_.push_back(kNotInList);
+            next_.push_back(kNotInList);
         }
-        holder[pos] = value;
-        return;
     }
-    T Victim(int &pos) {
-        pos = (*holder.begin()).first;
-        T ret=holder.begin()->second;
-        holder.erase(holder.begin());
-        return ret;
-    };
-    size_t Size() { return holder.size(); }
+    void Admit(int, int) override {}
+    void Pin(int frame) override {
+        if (next_[frame + 1] == kNotInList) return;
+        next_[prev_[frame + 1] + 1] = next_[frame + 1];
+        prev_[next_[frame + 1] + 1] = prev_[frame + 1];
+        prev_[frame + 1] = next_[frame + 1] = kNotInList;
+        --size_;
+    }
+    /** Adds a frame as the most recently used eviction candidate. */
+    void Unpin(int frame) override {
+        if (next_[frame + 1] != kNotInList) Pin(frame);
+        int tail = prev_[0];
+        prev_[frame + 1] = tail;
+        next_[frame + 1] = -1;
+        next_[tail + 1] = frame;
+        prev_[0] = frame;
+        ++size_;
+    }
+    /** Picks the least recently used frame and removes it from the candidates. */
+    bool Victim(int &frame) override {
+        if (size_ == 0) return false;
+        frame = next_[0];
+        Pin(frame);
+        return true;
+    }
+    /** Gets the least recently used frame without removing it. */
+    bool Peek(int &frame) const override {
+        if (size_ == 0) return false;
+        frame = next_[0];
+        return true;
+    }
+    void Forget(int frame) override { Pin(frame); }
+    size_t Size() override { return size_; }
 
-    linked_hashmap<int, T> holder;
+   private:
+    static constexpr int kNotInList = -2;
+    int Capacity() { return static_cast<int>(prev_.size()) - 1; }
+    // prev_[i + 1] / next_[i + 1] are the neighbours of frame i
+    lin::vector<int> prev_, next_;
+    size_t size_ = 0;
 };
 
 }  // namespace huang
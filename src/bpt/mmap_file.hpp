@@ -0,0 +1,96 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace huang {
+
+/**
+ * MmapFile maps a whole file into memory at a fixed address.
+ *
+ * A large range of address space is reserved up front, so the mapping never
+ * moves and pointers into it stay valid while the file grows. The file
+ * itself grows in chunks of kGrowChunk bytes; touching the reserved range
+ * past the end of the file is not allowed, callers must Reserve() first.
+ */
+class MmapFile {
+   public:
+    static constexpr size_t kAddressSpace = 1UL << 36;  // 64 GiB per file
+    static constexpr size_t kGrowChunk = 1UL << 24;    // 16 MiB
+
+    MmapFile() {}
+    MmapFile(const MmapFile &) = delete;
+    MmapFile &operator=(const MmapFile &) = delete;
+    ~MmapFile() { Close(); }
+
+    /** Maps `filename`, creating it if needed. Returns false on failure. */
+    bool Open(const std::string &filename) {
+        fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) != 0) {
+            Close();
+            return false;
+        }
+        size_ = st.st_size;
+        void *addr = mmap(nullptr, kAddressSpace, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd_, 0);
+        if (addr == MAP_FAILED) {
+            Close();
+            return false;
+        }
+        data_ = static_cast<char *>(addr);
+        return true;
+    }
+    bool IsOpen() const { return data_ != nullptr; }
+    char *Data() const { return data_; }
+    /**
+     * Makes sure bytes [0, bytes) of the mapping are backed by the file.
+     * Returns false if the file cannot grow (no space, file size limit); the
+     * bytes past Size() must then not be touched, a store there raises SIGBUS.
+     */
+    [[nodiscard]] bool Reserve(size_t bytes) {
+        if (bytes <= size_) return true;
+        size_t new_size = (bytes + kGrowChunk - 1) / kGrowChunk * kGrowChunk;
+        if (ftruncate(fd_, new_size) != 0) return false;
+        size_ = new_size;
+        return true;
+    }
+    /** Waits until bytes [0, bytes) of the mapping are on disk. */
+    void Sync(size_t bytes) {
+        if (data_ && bytes) msync(data_, bytes, MS_SYNC);
+    }
+    size_t Size() const { return size_; }
+    void Close() {
+        if (data_) munmap(data_, kAddressSpace);
+        if (fd_ >= 0) ::close(fd_);
+        data_ = nullptr;
+        fd_ = -1;
+        size_ = 0;
+    }
+
+   private:
+    int fd_ = -1;
+    char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+/**
+ * Reports that `what` failed on `filename` and stops the process. For I/O
+ * errors a caller has no way to hand back, such as a mapped node that cannot
+ * be created; stopping before anything is written keeps the files in a state
+ * the next start can open (and the redo log can repair).
+ */
+[[noreturn]] inline void FailIo(const char *what, const std::string &filename) {
+    std::cerr << what << ' ' << filename << ": " << strerror(errno) << std::endl;
+    std::abort();
+}
+
+}  // namespace huang
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "bufferpool.hpp"
+#include "log_manager.hpp"
+
+namespace huang {
+
+/**
+ * PageFile is a file of fixed-size pages that callers address by number and
+ * change in place, for data that does not fit in the value of a B+ tree.
+ *
+ * Pages are handed out in runs by Allocate() and never freed. They are
+ * cached by a BufferPool and logged like the nodes of a BPlusTree: with the
+ * redo log enabled, a changed page stays pinned until its after-image is in
+ * the log. With StorageMode::kMmap and no log, the file is mapped instead.
+ * The first kHeaderSize bytes of the file hold the number of pages.
+ */
+template <class Page, int kBufferSize = 400>
+class PageFile : public LogClient {
+   public:
+    using Guard = typename BufferPool<Page, kBufferSize>::Guard;
+    static constexpr int kHeaderSize = sizeof(int64_t);
+
+    explicit PageFile(const std::string &filename, StorageMode mode = StorageMode::kBufferPool)
+        : filename_(filename) {
+        file_.open(filename_);
+        if (!file_) {
+            file_.open(filename_, std::ios::out);
+            file_.close();
+            file_.open(filename_);
+        }
+        file_.seekg(0, std::ios::end);
+        if (file_.tellg() >= kHeaderSize) {
+            file_.seekg(0);
+            file_.read(reinterpret_cast<char *>(&pages_), kHeaderSize);
+        }
+        pool_.Open(&file_, filename_, kHeaderSize);
+        if (LogManager::Instance().Enabled()) {
+            log_ = &LogManager::Instance();
+            log_->Register(this);
+            file_id_ = log_->AddFile(filename_);
+            pool_.Attach(log_, file_id_);
+        } else if (mode == StorageMode::kMmap && !pool_.Map()) {
+            std::cerr << "cannot map " << filename_ << ", falling back to the buffer pool" << std::endl;
+        }
+    }
+    PageFile(const PageFile &) = delete;
+    PageFile &operator=(const PageFile &) = delete;
+    ~PageFile() {
+        if (log_) {
+            log_->Checkpoint();
+            log_->Unregister(this);
+            pool_.Attach(nullptr, file_id_);
+        }
+        WriteHeader();
+        pool_.FlushAll();
+        file_.close();
+    }
+
+    /** Reserves `num` consecutive new pages and returns the number of the first one. */
+    int Allocate(int num) {
+        int first = static_cast<int>(pages_);
+        pages_ += num;
+        return first;
+    }
+    /** The number of pages allocated so far. */
+    int Size() const { return static_cast<int>(pages_); }
+    /** Pins page `pos`. Call MarkDirty() on the guard before changing it. */
+    Guard Fetch(int pos) { return pool_.Fetch(pos); }
+    /** Pins page `pos` without reading it, already marked dirty; the caller overwrites the whole page. */
+    Guard Create(int pos) { return pool_.Create(pos); }
+
+    void WriteLog(LogManager &log) override {
+        pool_.WriteLog();
+        log.Append(file_id_, 0, &pages_, kHeaderSize);
+    }
+    void Flush() override {
+        WriteHeader();
+        pool_.FlushAll();
+        file_.flush();
+        SyncFile(filename_);
+    }
+
+   private:
+    std::string filename_;
+    std::fstream file_;
+    BufferPool<Page, kBufferSize> pool_;
+    int64_t pages_ = 0;
+    LogManager *log_ = nullptr;
+    int file_id_ = -1;
+
+    void WriteHeader() {
+        file_.seekp(0);
+        file_.write(reinterpret_cast<const char *>(&pages_), kHeaderSize);
+    }
+};
+
+}  // namespace huang
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+
+namespace huang {
+
+/**
+ * Which ReplacementPolicy the buffer pools use.
+ * - kLru: plain least recently used, see LRUReplacer.
+ * - kTwoQueue: scan resistant, see TwoQueueReplacer.
+ */
+enum class ReplacerKind { kLru, kTwoQueue };
+
+/**
+ * ReplacementPolicy decides which frame of a buffer pool is reused next.
+ *
+ * It tracks frames by index. A frame is admitted pinned when a node is put
+ * into it, and is a candidate for eviction whenever it is unpinned, until
+ * Victim() picks it or Forget() drops it.
+ */
+class ReplacementPolicy {
+   public:
+    virtual ~ReplacementPolicy() = default;
+    /** Makes room for frames [0, num). */
+    virtual void Resize(int num) = 0;
+    /** Called when node `pos` is put into `frame`, which is pinned. */
+    virtual void Admit(int frame, int pos) = 0;
+    /** Removes a frame from the eviction candidates. */
+    virtual void Pin(int frame) = 0;
+    /** Makes a frame an eviction candidate again; every unpin counts as a use. */
+    virtual void Unpin(int frame) = 0;
+    /** Picks the frame to reuse and forgets it. Returns false if every frame is pinned. */
+    virtual bool Victim(int &frame) = 0;
+    /** Gets the frame Victim() would pick without removing it. */
+    virtual bool Peek(int &frame) const = 0;
+    /** Forgets a frame whose node was dropped, pinned or not. */
+    virtual void Forget(int frame) = 0;
+    /** The number of eviction candidates. */
+    virtual size_t Size() = 0;
+};
+
+}  // namespace huang
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "../lib/vector.h"
+#include "flat_hashmap.hpp"
+#include "replacement_policy.hpp"
+
+namespace huang {
+
+/**
+ * TwoQueueReplacer implements the 2Q replacement policy, which a scan cannot
+ * flush.
+ *
+ * A node read for the first time goes to the probation queue (A1in). When it
+ * is evicted from there, its position is remembered in a ghost queue (A1out)
+ * that holds no data. Only a node read again while its ghost is remembered
+ * goes to the main queue (Am). The probation queue gives up frames first as
+ * long as it holds more than a quarter of the frames. So the leaves of a long
+ * range scan, each read once, cycle through probation while the nodes used
+ * across commands stay in the main queue.
+ *
+ * Unlike textbook 2Q, both queues are ordered by the last unpin, because
+ * pinned frames are not in either queue.
+ */
+class TwoQueueReplacer : public ReplacementPolicy {
+   public:
+    TwoQueueReplacer() {
+        // nodes 0 and 1 are the sentinels of the circular lists, frame i is node i + 2
+        for (int i = 0; i < 2; i++) {
+            prev_.push_back(i);
+            next_.push_back(i);
+        }
+    }
+    void Resize(int num) override {
+        while (static_cast<int>(queue_.size()) < num) {
+            prev_.push_back(kNotInList);
+            next_.push_back(kNotInList);
+            queue_.push_back(kNone);
+            pos_.push_back(-1);
+        }
+    }
+    void Admit(int frame, int pos) override {
+        auto it = ghosts_.find(pos);
+        if (it != ghosts_.end()) {
+            ghosts_.erase(it);
+            queue_[frame] = kMain;
+        } else {
+            queue_[frame] = kProbation;
+        }
+        pos_[frame] = pos;
+        ++resident_[queue_[frame]];
+    }
+    void Pin(int frame) override {
+        int node = frame + 2;
+        if (next_[node] == kNotInList) return;
+        next_[prev_[node]] = next_[node];
+        prev_[next_[node]] = prev_[node];
+        prev_[node] = next_[node] = kNotInList;
+        --size_;
+    }
+    void Unpin(int frame) override {
+        Pin(frame);
+        int node = frame + 2, list = queue_[frame];
+        prev_[node] = prev_[list];
+        next_[node] = list;
+        next_[prev_[list]] = node;
+        prev_[list] = node;
+        ++size_;
+    }
+    bool Victim(int &frame) override {
+        if (!Peek(frame)) return false;
+        if (queue_[frame] == kProbation) {
+            ghosts_.insert({pos_[frame], 0});
+            size_t limit = (resident_[kProbation] + resident_[kMain]) / 2 + kMinGhosts;
+            while (ghosts_.size() > limit) ghosts_.erase(ghosts_.begin());
+        }
+        Forget(frame);
+        return true;
+    }
+    bool Peek(int &frame) const override {
+        if (size_ == 0) return false;
+        // probation gives up frames first while it is over its share, or when main has no candidate
+        int list = kProbation;
+        if ((resident_[kProbation] <= (resident_[kProbation] + resident_[kMain]) / 4 && next_[kMain] != kMain) ||
+            next_[kProbation] == kProbation)
+            list = kMain;
+        frame = next_[list] - 2;
+        return true;
+    }
+    void Forget(int frame) override {
+        Pin(frame);
+        if (queue_[frame] == kNone) return;
+        --resident_[queue_[frame]];
+        queue_[frame] = kNone;
+    }
+    size_t Size() override { return size_; }
+
+   private:
+    static constexpr int kProbation = 0, kMain = 1, kNone = 2;
+    static constexpr int kNotInList = -1;
+    static constexpr size_t kMinGhosts = 8;
+    lin::vector<int> prev_, next_;  // neighbours of every node
+    lin::vector<int> queue_;        // the queue of each frame, pinned or not
+    lin::vector<int> pos_;          // the node held by each frame
+    size_t resident_[2] = {0, 0};   // frames of each queue, pinned or not
+    size_t size_ = 0;
+    // positions recently evicted from probation, oldest first
+    flat_hashmap<int, char, std::hash<int>, std::equal_to<int>, true> ghosts_;
+};
+
+}  // namespace huang
@@ -1,8 +1,10 @@
 #include "command_parser.h"
 
 #include <cstring>
+#include <fstream>
 #include <iostream>
 
+#include "bpt/log_manager.hpp"
 #include "lib/datetime.h"
 #include "lib/vector.h"
 #include "train.h"
@@ -97,6 +99,10 @@ void CommandParser::Run() {
             res = ParseReleaseTrain();
         } else if (command == "refund_ticket") {  // Normal
             res = ParseRefundTicket();
+        } else if (command == "import_trains") {  // Rare
+            res = ParseImportTrains();
+        } else if (command == "release_trains") {  // Rare
+            res = ParseReleaseTrains();
         } else if (command == "rollback") {  // Rare
             res = ParseRollback();
         } else if (command == "clean") {
@@ -106,6 +112,8 @@ void CommandParser::Run() {
             std::cout << '[' << timestamp << "] " << res << '\n';
             break;
         }
+        // 按持久化级别决定是否提交这一组指令的日志，再输出结果
+        huang::LogManager::Instance().EndCommand();
         std::cout << '[' << timestamp << "] " << res << '\n';
     }
 }
@@ -138,7 +146,7 @@ std::string CommandParser::ParseAddUser() {
                 break;
         }
     }
-    return user_manager_->AddUser(timestamp, cur_username, username, password,
+    return user_manager_->AddUser(cur_username, username, password,
                                   name, email, privilege);
 }
 std::string CommandParser::ParseLogin() {
@@ -156,7 +164,7 @@ std::string CommandParser::ParseLogin() {
                 break;
         }
     }
-    return user_manager_->Login(timestamp, username, password);
+    return user_manager_->Login(username, password);
 }
 std::string CommandParser::ParseLogout() {
     std::string_view username;
@@ -170,7 +178,7 @@ std::string CommandParser::ParseLogout() {
                 break;
         }
     }
-    return user_manager_->Logout(timestamp, username);
+    return user_manager_->Logout(username);
 }
 std::string CommandParser::ParseQueryProfile() {
     std::string_view cur_username, username;
@@ -187,7 +195,7 @@ std::string CommandParser::ParseQueryProfile() {
                 break;
         }
     }
-    return user_manager_->QueryProfile(timestamp, cur_username, username);
+    return user_manager_->QueryProfile(cur_username, username);
 }
 std::string CommandParser::ParseModifyProfile() {
     std::string_view cur_username, username;
@@ -218,11 +226,11 @@ std::string CommandParser::ParseModifyProfile() {
                 break;
         }
     }
-    return user_manager_->ModifyProfile(timestamp, cur_username, username,
+    return user_manager_->ModifyProfile(cur_username, username,
                                         password, name, email, privilege);
 }
 
-std::string CommandParser::ParseAddTrain() {
+Train CommandParser::ParseTrain() {
     // 添加<trainID>为-i，<stationNum>为-n，<seatNum>为-m，
     // <stations>为-s，<prices>为-p，<startTime>为-x，<travelTimes>为-t，<stopoverTimes>为-o，<saleDate>为-d，<type>为-y的车次。
     // 由于-s、-p、-t、-o和-d由多个值组成，输入时两个值之间以|隔开（仍是一个不含空格的字符串）。
@@ -290,7 +298,44 @@ std::string CommandParser::ParseAddTrain() {
                 Duration(ParseNumber(stop_times_string[j]));
         }
     }
-    return train_manager_->AddTrain(timestamp, train);
+    return train;
+}
+
+std::string CommandParser::ParseAddTrain() {
+    return train_manager_->AddTrain(ParseTrain());
+}
+
+std::string CommandParser::ParseImportTrains() {
+    // 时刻表文件每行是一条 add_train 的参数，行首的时间戳和指令名可有可无
+    std::string_view filename;
+    for (int i = 1; i < argv.size(); i += 2) {
+        switch (argv[i][1]) {
+            case 'f':
+                filename = argv[i + 1];
+                break;
+            default:
+                throw UnknownParameter();
+                break;
+        }
+    }
+    std::ifstream file{std::string(filename)};
+    if (!file) return "-1";
+    vector<Train> trains;
+    char line[kInputBufferSize];
+    while (file.getline(line, kInputBufferSize)) {
+        argv = Split(line);
+        int first = 0;
+        while (first < argv.size() && argv[first][0] != '-') ++first;
+        if (first == argv.size()) continue;
+        // ParseTrain 从 argv[1] 开始读参数
+        vector<char *> args;
+        args.push_back(nullptr);
+        for (int i = first; i < argv.size(); ++i) args.push_back(argv[i]);
+        argv = args;
+        trains.push_back(ParseTrain());
+    }
+    if (!file.eof()) return "-1";  // 某行超出缓冲区或读取出错，不导入半个文件
+    return train_manager_->ImportTrains(trains);
 }
 
 std::string CommandParser::ParseDeleteTrain() {
@@ -305,7 +350,7 @@ std::string CommandParser::ParseDeleteTrain() {
                 break;
         }
     }
-    return train_manager_->DeleteTrain(timestamp, train_id);
+    return train_manager_->DeleteTrain(train_id);
 }
 
 std::string CommandParser::ParseReleaseTrain() {
@@ -320,7 +365,25 @@ std::string CommandParser::ParseReleaseTrain() {
                 break;
         }
     }
-    return train_manager_->ReleaseTrain(timestamp, train_id);
+    return train_manager_->ReleaseTrain(train_id);
+}
+
+std::string CommandParser::ParseReleaseTrains() {
+    // 一次发布多个车次，-i 后的 train_id 之间以 | 隔开
+    vector<std::string_view> train_ids;
+    for (int i = 1; i < argv.size(); i += 2) {
+        switch (argv[i][1]) {
+            case 'i': {
+                auto ids = Split(argv[i + 1], '|');
+                for (int j = 0; j < ids.size(); ++j) train_ids.push_back(ids[j]);
+                break;
+            }
+            default:
+                throw UnknownParameter();
+                break;
+        }
+    }
+    return train_manager_->ReleaseTrains(train_ids);
 }
 
 std::string CommandParser::ParseQueryTrain() {
@@ -339,7 +402,7 @@ std::string CommandParser::ParseQueryTrain() {
                 break;
         }
     }
-    return train_manager_->QueryTrain(timestamp, train_id, date);
+    return train_manager_->QueryTrain(train_id, date);
 }
 
 std::string CommandParser::ParseQueryTicket() {
@@ -369,7 +432,7 @@ std::string CommandParser::ParseQueryTicket() {
                 break;
         }
     }
-    return train_manager_->QueryTicket(timestamp, date, start_station,
+    return train_manager_->QueryTicket(date, start_station,
                                        terminal_station, sort_order);
 }
 
@@ -400,7 +463,7 @@ std::string CommandParser::ParseQueryTransfer() {
                 break;
         }
     }
-    return train_manager_->QueryTransfer(timestamp, date, start_station,
+    return train_manager_->QueryTransfer(date, start_station,
                                          terminal_station, sort_order);
 }
 
@@ -455,7 +518,7 @@ std::string CommandParser::ParseQueryOrder() {
         }
     }
     if (!user_manager_->IsLoggedIn(username)) return "-1";
-    return train_manager_->QueryOrder(timestamp, username);
+    return train_manager_->QueryOrder(username);
 }
 
 std::string CommandParser::ParseRefundTicket() {
@@ -475,7 +538,7 @@ std::string CommandParser::ParseRefundTicket() {
         }
     }
     if (!user_manager_->IsLoggedIn(username)) return "-1";
-    return train_manager_->RefundTicket(timestamp, username, num);
+    return train_manager_->RefundTicket(username, num);
 }
 
 std::string CommandParser::ParseRollback() {
@@ -490,10 +553,10 @@ std::string CommandParser::ParseRollback() {
                 break;
         }
     }
-    user_manager_->RollBack(to_time);
-    train_manager_->RollBack(to_time);
+    // 两个 manager 都没有保存历史版本，无法回滚
+    return "-1";
 }
 
-std::string CommandParser::ParseClean() { ; }
+std::string CommandParser::ParseClean() { return "-1"; }  // 尚未支持
 
 }  // namespace lin
\ No newline at end of file
@@ -7,6 +7,7 @@
 namespace lin {
 class UserManager;
 class TrainManager;
+struct Train;
 /**
  * @brief 解析输入指令，并调用相应的函数。
  */
@@ -45,9 +46,15 @@ class CommandParser {
   std::string ParseLogout();
   std::string ParseQueryProfile();
   std::string ParseModifyProfile();
+  /**
+   * @brief 从 argv 中解析一辆火车的信息，供 add_train 和 import_trains 使用。
+   */
+  Train ParseTrain();
   std::string ParseAddTrain();
+  std::string ParseImportTrains();
   std::string ParseDeleteTrain();
   std::string ParseReleaseTrain();
+  std::string ParseReleaseTrains();
   std::string ParseQueryTrain();
   std::string ParseQueryTicket();
   std::string ParseQueryTransfer();
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "../bpt/bpt.hpp"
-#include "../bpt/linked_hashmap.hpp"
+#include "../bpt/flat_hashmap.hpp"
 #include "../lib/datetime.h"
 
 namespace huang {
@@ -35,9 +35,11 @@ template <class Key, class Value, int kValueBufferSize = 1000, int kInternalSize
     int kInternalBufferSize = 50, int kLeafBufferSize = 50>
 class BPTree {
   BPlusTree<Key, Value, kInternalSize, kLeafSize, kInternalSize, kLeafBufferSize> bpt;
-  linked_hashmap<Key, Value, Hash<Key>> buffer;
+  flat_hashmap<Key, Value, Hash<Key>, std::equal_to<Key>, true> buffer;  // 按插入顺序淘汰
 
  public:
+  using Cursor = typename BPlusTree<Key, Value, kInternalSize, kLeafSize, kInternalSize, kLeafBufferSize>::Cursor;
+
   BPTree(const std::string& name) : bpt(name) {}
 
   bool Empty() { return bpt.Empty(); }
@@ -61,11 +63,27 @@ class BPTree {
   void GetValue(const Key& min_key, const Key& max_key, lin::vector<Value>* ans) {
     return bpt.GetValue(min_key, max_key, ans);
   }
+  // 游标直接读 B+ 树，缓存里的值与树上的始终一致
+  Cursor SeekForward(const Key& key) { return bpt.SeekForward(key); }
+  Cursor SeekBackward(const Key& key) { return bpt.SeekBackward(key); }
   void Modify(const Key& key, const Value& new_value) {
     bpt.Modify(key, new_value);
     auto it = buffer.find(key);
     if (it != buffer.end()) it->second = new_value;
   }
+  bool Upsert(const Key& key, const Value& value) {
+    auto it = buffer.find(key);
+    if (it != buffer.end()) it->second = value;
+    return bpt.Upsert(key, value);
+  }
+  template <class Fn>
+  bool Update(const Key& key, Fn fn) {
+    auto it = buffer.find(key);
+    return bpt.Update(key, [&](Value& value) {
+      fn(value);
+      if (it != buffer.end()) it->second = value;
+    });
+  }
 };
 
 }  // namespace huang
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "seat_kernels.h"
+
+#include <algorithm>
+#include <climits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LIN_SEAT_KERNELS_X86
+#endif
+
+namespace lin {
+
+namespace {
+
+int RangeMinScalar(const int *seats, int l, int r) {
+  int res = INT_MAX;
+  for (int i = l; i < r; ++i) res = std::min(res, seats[i]);
+  return res;
+}
+void RangeAddScalar(int *seats, int l, int r, int x) {
+  for (int i = l; i < r; ++i) seats[i] += x;
+}
+
+#ifdef LIN_SEAT_KERNELS_X86
+// 末尾一组中下标小于 n 的元素为全 1
+__attribute__((target("sse4.1"))) __m128i TailMask4(int n) {
+  return _mm_cmplt_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(n));
+}
+__attribute__((target("avx2"))) __m256i TailMask8(int n) {
+  return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+__attribute__((target("sse4.1"))) int RangeMinSse4(const int *seats, int l, int r) {
+  __m128i res = _mm_set1_epi32(INT_MAX);
+  int i = l;
+  for (; i + 4 <= r; i += 4) res = _mm_min_epi32(res, _mm_loadu_si128(reinterpret_cast<const __m128i *>(seats + i)));
+  if (i < r) {
+    __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(seats + i));
+    res = _mm_min_epi32(res, _mm_blendv_epi8(_mm_set1_epi32(INT_MAX), tail, TailMask4(r - i)));
+  }
+  res = _mm_min_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(1, 0, 3, 2)));
+  res = _mm_min_epi32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(res);
+}
+__attribute__((target("sse4.1"))) void RangeAddSse4(int *seats, int l, int r, int x) {
+  __m128i add = _mm_set1_epi32(x);
+  int i = l;
+  for (; i + 4 <= r; i += 4) {
+    __m128i *p = reinterpret_cast<__m128i *>(seats + i);
+    _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), add));
+  }
+  if (i < r) {
+    // 区间外的元素原样写回
+    __m128i *p = reinterpret_cast<__m128i *>(seats + i);
+    __m128i old = _mm_loadu_si128(p);
+    _mm_storeu_si128(p, _mm_blendv_epi8(old, _mm_add_epi32(old, add), TailMask4(r - i)));
+  }
+}
+
+__attribute__((target("avx2"))) int RangeMinAvx2(const int *seats, int l, int r) {
+  __m256i res = _mm256_set1_epi32(INT_MAX);
+  int i = l;
+  for (; i + 8 <= r; i += 8)
+    res = _mm256_min_epi32(res, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(seats + i)));
+  if (i < r) {
+    __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(seats + i));
+    res = _mm256_min_epi32(res, _mm256_blendv_epi8(_mm256_set1_epi32(INT_MAX), tail, TailMask8(r - i)));
+  }
+  __m128i half = _mm_min_epi32(_mm256_castsi256_si128(res), _mm256_extracti128_si256(res, 1));
+  half = _mm_min_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+  half = _mm_min_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(half);
+}
+__attribute__((target("avx2"))) void RangeAddAvx2(int *seats, int l, int r, int x) {
+  __m256i add = _mm256_set1_epi32(x);
+  int i = l;
+  for (; i + 8 <= r; i += 8) {
+    __m256i *p = reinterpret_cast<__m256i *>(seats + i);
+    _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p), add));
+  }
+  if (i < r) {
+    __m256i mask = TailMask8(r - i);
+    int *p = seats + i;
+    _mm256_maskstore_epi32(p, mask, _mm256_add_epi32(_mm256_maskload_epi32(p, mask), add));
+  }
+}
+#endif
+
+struct Kernels {
+  int (*range_min)(const int *, int, int);
+  void (*range_add)(int *, int, int, int);
+};
+
+bool Supported(SeatKernel kernel) {
+#ifdef LIN_SEAT_KERNELS_X86
+  __builtin_cpu_init();  // 可能在 libgcc 自己初始化之前的静态初始化中被调用
+  if (kernel == SeatKernel::kAvx2) return __builtin_cpu_supports("avx2");
+  if (kernel == SeatKernel::kSse4) return __builtin_cpu_supports("sse4.1");
+  return true;
+#else
+  return kernel == SeatKernel::kScalar;
+#endif
+}
+
+Kernels KernelsOf(SeatKernel kernel) {
+#ifdef LIN_SEAT_KERNELS_X86
+  if (kernel == SeatKernel::kAvx2) return {RangeMinAvx2, RangeAddAvx2};
+  if (kernel == SeatKernel::kSse4) return {RangeMinSse4, RangeAddSse4};
+#endif
+  return {RangeMinScalar, RangeAddScalar};
+}
+
+// 在静态初始化时选好，此后只在 UseSeatKernel 中改变
+Kernels current = KernelsOf(BestSeatKernel());
+
+}  // namespace
+
+SeatKernel BestSeatKernel() {
+  if (Supported(SeatKernel::kAvx2)) return SeatKernel::kAvx2;
+  if (Supported(SeatKernel::kSse4)) return SeatKernel::kSse4;
+  return SeatKernel::kScalar;
+}
+
+bool UseSeatKernel(SeatKernel kernel) {
+  if (!Supported(kernel)) return false;
+  current = KernelsOf(kernel);
+  return true;
+}
+
+const char *SeatKernelName(SeatKernel kernel) {
+  switch (kernel) {
+    case SeatKernel::kAvx2: return "avx2";
+    case SeatKernel::kSse4: return "sse4";
+    default: return "scalar";
+  }
+}
+
+int SeatRangeMin(const int *seats, int l, int r) { return current.range_min(seats, l, r); }
+void SeatRangeAdd(int *seats, int l, int r, int x) { current.range_add(seats, l, r, x); }
+
+}  // namespace lin
@@ -0,0 +1,30 @@
+#pragma once
+
+namespace lin {
+
+/**
+ * @brief 余票数组上的区间最小值和区间加，按 CPU 支持的指令集选 AVX2、SSE4.1 或标量实现。
+ *
+ * 向量实现一次处理 kSeatLanes 个元素，末尾不足一组时读写整组、用掩码屏蔽区间外的元素，
+ * 所以数组在最后一个可能的下标之后至少要再留 kSeatLanes - 1 个元素（见 kSeatSlots）。
+ * 余票数组放在 B+ 树的节点里，节点在映射的文件中的位置不一定对齐，所以只用非对齐访存。
+ */
+enum class SeatKernel { kScalar, kSse4, kAvx2 };
+
+/// 向量实现一次处理的最多元素数
+constexpr int kSeatLanes = 8;
+/// 能存 \p n 个元素的余票数组应开的长度：补足末尾的一组，并取 kSeatLanes 的倍数
+constexpr int SeatSlots(int n) { return (n + kSeatLanes - 1 + kSeatLanes - 1) / kSeatLanes * kSeatLanes; }
+
+/// 当前 CPU 支持的最快实现
+SeatKernel BestSeatKernel();
+/// 之后的 SeatRangeMin / SeatRangeAdd 使用 \p kernel；CPU 不支持时返回 false 且不切换。
+bool UseSeatKernel(SeatKernel kernel);
+const char *SeatKernelName(SeatKernel kernel);
+
+/// seats[l, r) 的最小值，区间为空时返回 INT_MAX
+int SeatRangeMin(const int *seats, int l, int r);
+/// seats[l, r) 的每个元素加上 x
+void SeatRangeAdd(int *seats, int l, int r, int x);
+
+}  // namespace lin
@@ -307,7 +307,7 @@ class vector {
     return insert(iterator(start_ + ind, this), value);
   }
   iterator erase(iterator pos) {
-    for (pointer i = pos.ptr_; i != finish_; ++i) {
+    for (pointer i = pos.ptr_; i + 1 != finish_; ++i) {
       // *i = *(i + 1);  // TODO: check performance
       *i = std::move(*(i + 1));
     }
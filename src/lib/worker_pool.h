@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lin {
+
+/**
+ * @brief 一组常驻的工作线程，每次 Run() 把编号为 [0, tasks) 的任务分给它们和调用者。
+ *
+ * 任务由各线程从一个原子计数器上领取，所以执行顺序不确定；需要确定结果的调用者
+ * 应按任务编号存放结果，Run() 返回后再按编号合并。任务之间不能共享可写的状态。
+ */
+class WorkerPool {
+ public:
+  /// 连同调用者共 \p threads 个线程
+  explicit WorkerPool(int threads) {
+    for (int i = 1; i < threads; ++i) workers_.emplace_back([this] { Work(); });
+  }
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &worker : workers_) worker.join();
+  }
+
+  int Threads() const { return static_cast<int>(workers_.size()) + 1; }
+
+  /// 对每个 task ∈ [0, tasks) 调用一次 fn(task)，全部完成后返回。不可重入。
+  void Run(int tasks, const std::function<void(int)> &fn) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      fn_ = &fn;
+      tasks_ = tasks;
+      next_ = 0;
+      pending_ = workers_.size();
+      ++generation_;
+    }
+    wake_.notify_all();
+    RunTasks(fn);
+    // 等每个线程都做完这一轮，下一轮才能改 fn_ 和 next_
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+  }
+
+ private:
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_, done_;
+  const std::function<void(int)> *fn_ = nullptr;
+  int tasks_ = 0;
+  std::atomic<int> next_{0};  // 下一个未被领取的任务
+  size_t pending_ = 0;  // 本轮还没做完的工作线程数
+  uint64_t generation_ = 0;  // Run() 的轮次
+  bool stop_ = false;
+
+  void RunTasks(const std::function<void(int)> &fn) {
+    for (int task; (task = next_.fetch_add(1)) < tasks_;) fn(task);
+  }
+  void Work() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+      if (stop_) return;
+      seen = generation_;
+      const std::function<void(int)> *fn = fn_;
+      lock.unlock();
+      RunTasks(*fn);
+      lock.lock();
+      if (--pending_ == 0) done_.notify_one();
+    }
+  }
+};
+
+}  // namespace lin
@@ -1,13 +1,55 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "bpt/buffer_manager.hpp"
+#include "bpt/log_manager.hpp"
 #include "train.h"
+#include "transfer.h"
 #include "user.h"
 // #include "train.h"
 // #include "order.h"
 #include "command_parser.h"
 
-int main() {
+int main(int argc, char *argv[]) {
+  // --durability=none|async|group|sync，默认 group：每组指令 fsync 一次日志
+  huang::Durability durability = huang::Durability::kGroup;
+  int group_size = huang::LogManager::kDefaultGroupSize;
+  // --buffer-budget=<MiB>：所有树的缓存共用的内存上限，0 表示每棵树各用固定数量的缓存
+  long long buffer_budget = 64;
+  bool buffer_stats = false;
+  huang::ReplacerKind replacer = huang::ReplacerKind::kTwoQueue;
+  // --pair-index-budget=<MiB>：站对索引的磁盘上限，0 表示查票只用归并
+  long long pair_index_budget = lin::TrainManager::kDefaultPairIndexBudget >> 20;
+  // --transfer-threads=<n>：query_transfer 的线程数，0 表示按 CPU 核数（至多 8）
+  int transfer_threads = 0;
+  // --seat-layout=record|matrix：新数据库的余票布局
+  lin::SeatLayout seat_layout = lin::SeatLayout::kRecord;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--durability=none")) durability = huang::Durability::kNone;
+    if (!strcmp(argv[i], "--durability=async")) durability = huang::Durability::kAsync;
+    if (!strcmp(argv[i], "--durability=group")) durability = huang::Durability::kGroup;
+    if (!strcmp(argv[i], "--durability=sync")) durability = huang::Durability::kSync;
+    if (!strncmp(argv[i], "--group-size=", 13)) group_size = atoi(argv[i] + 13);
+    if (!strncmp(argv[i], "--buffer-budget=", 16)) buffer_budget = atoll(argv[i] + 16);
+    if (!strcmp(argv[i], "--buffer-stats")) buffer_stats = true;
+    if (!strcmp(argv[i], "--replacer=lru")) replacer = huang::ReplacerKind::kLru;
+    if (!strcmp(argv[i], "--replacer=2q")) replacer = huang::ReplacerKind::kTwoQueue;
+    if (!strncmp(argv[i], "--pair-index-budget=", 20)) pair_index_budget = atoll(argv[i] + 20);
+    if (!strncmp(argv[i], "--transfer-threads=", 19)) transfer_threads = atoi(argv[i] + 19);
+    if (!strcmp(argv[i], "--seat-layout=record")) seat_layout = lin::SeatLayout::kRecord;
+    if (!strcmp(argv[i], "--seat-layout=matrix")) seat_layout = lin::SeatLayout::kMatrix;
+  }
+  if (transfer_threads <= 0) transfer_threads = std::clamp<int>(std::thread::hardware_concurrency(), 1, 8);
+  huang::BufferManager::Instance().SetBudget(buffer_budget << 20);
+  huang::BufferManager::Instance().SetPolicy(replacer);
+  lin::TransferEngine::SetThreads(transfer_threads);
+  // 必须在打开任何一棵树之前重放日志
+  huang::LogManager::Instance().Open("redo_log.dat", durability, group_size);
   lin::UserManager user_manager;
-  lin::TrainManager train_manager;
+  lin::TrainManager train_manager(static_cast<size_t>(pair_index_budget) << 20, seat_layout);
   lin::CommandParser command_parser(&user_manager, &train_manager);
   command_parser.Run();
+  if (buffer_stats) std::cerr << huang::BufferManager::Instance().Report();
   return 0;
 }
\ No newline at end of file
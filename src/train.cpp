@@ -1,12 +1,14 @@
 #include "train.h"
 
-#include <unordered_map>
+#include <cstdint>
+#include <cstring>
 
 #include "lib/datetime.h"
 #include "lib/exception.h"
 #include "lib/hash.h"
 #include "lib/tuple.h"
 #include "lib/utils.h"
+#include "transfer.h"
 
 namespace lin {
 
@@ -16,8 +18,33 @@ constexpr const int INT_MAX = 2147483647;
 constexpr const int INT_MIN = -2147483648;
 constexpr const auto kHashMin = 0UL;
 constexpr const auto kHashMax = SIZE_MAX;
+// 站对索引中的特殊项：关闭索引期间发布过车次，索引已不完整
+const PairTrainKey kStalePairIndex(StationDict::kNoStation, StationDict::kNoStation, kHashMin);
 }  // namespace
 
+PairTrain::PairTrain(const TrainView &train, int from_rank_, int to_rank_)
+    : train_id(train.head().id),
+      from_rank(from_rank_),
+      to_rank(to_rank_),
+      departure_time(train.departure_time(from_rank_)),
+      arrival_time(train.arrival_time(to_rank_)),
+      price(train.sum_price(to_rank_) - train.sum_price(from_rank_)),
+      start_sale(train.head().start_sale),
+      end_sale(train.head().end_sale),
+      seat_num(train.head().seat_num),
+      station_num(train.station_num()) {}
+PairTrain::PairTrain(const TrainHead &train, const StationTrain &from, const StationTrain &to)
+    : train_id(train.id),
+      from_rank(from.rank),
+      to_rank(to.rank),
+      departure_time(from.departure_time),
+      arrival_time(to.arrival_time),
+      price(to.sum_price - from.sum_price),
+      start_sale(train.start_sale),
+      end_sale(train.end_sale),
+      seat_num(train.seat_num),
+      station_num(train.station_num) {}
+
 TrainSeats::TrainSeats() {
   // throw Exception("Default Constructor of TrainSeats should not be used");
 }
@@ -52,13 +79,167 @@ int TrainSeatsWrap::operator[](int i) {
   return initial_seat_num;
 }
 
-int TrainSeats::RangeMin(int l, int r) {
-  int res = INT_MAX;
-  for (int i = l; i < r; ++i) res = std::min(res, seat_num[i]);
-  return res;
+int TrainSeats::RangeMin(int l, int r) { return SeatRangeMin(seat_num, l, r); }
+void TrainSeats::RangeAdd(int l, int r, int x) { SeatRangeAdd(seat_num, l, r, x); }
+
+SeatStore::SeatStore(SeatLayout layout) : layout_(layout) {
+  bool records = !seats32_.Empty() || !seats64_.Empty() || !seats128_.Empty() || !seats256_.Empty() ||
+                 !seats400_.Empty();
+  if (records && layout_ == SeatLayout::kMatrix) layout_ = SeatLayout::kRecord;
+  if (!seat_matrix_.Empty() && layout_ == SeatLayout::kRecord) layout_ = SeatLayout::kMatrix;
+  if (layout_ != layout) std::cerr << "seats are kept in the other layout, keeping it" << std::endl;
+}
+
+template <class Fn>
+bool SeatStore::WithTree(const SeatShape &shape, Fn fn) {
+  bool narrow = Narrow(shape);
+  switch (SizeClass(shape)) {
+    case 0: return fn(seats32_, narrow);
+    case 1: return fn(seats64_, narrow);
+    case 2: return fn(seats128_, narrow);
+    case 3: return fn(seats256_, narrow);
+    default: return fn(seats400_, narrow);
+  }
+}
+int SeatStore::SizeClass(const SeatShape &shape) {
+  int bytes = RowBytes(shape);
+  return bytes <= 32 ? 0 : bytes <= 64 ? 1 : bytes <= 128 ? 2 : bytes <= 256 ? 3 : 4;
+}
+int SeatStore::RowBytes(const SeatShape &shape) {
+  return (shape.station_num - 1) * (Narrow(shape) ? sizeof(uint16_t) : sizeof(int));
+}
+void SeatStore::Pack(const TrainSeats &seats, int segments, bool narrow, char *data) {
+  for (int i = 0; i < segments; ++i) {
+    if (narrow) {
+      uint16_t x = seats.seat_num[i];
+      memcpy(data + i * sizeof(x), &x, sizeof(x));
+    } else {
+      memcpy(data + i * sizeof(int), &seats.seat_num[i], sizeof(int));
+    }
+  }
+}
+void SeatStore::Unpack(const char *data, int segments, bool narrow, TrainSeats *seats) {
+  for (int i = 0; i < segments; ++i) {
+    if (narrow) {
+      uint16_t x;
+      memcpy(&x, data + i * sizeof(x), sizeof(x));
+      seats->seat_num[i] = x;
+    } else {
+      memcpy(&seats->seat_num[i], data + i * sizeof(int), sizeof(int));
+    }
+  }
+}
+
+bool SeatStore::FindRow(const Key &key, const SeatShape &shape, int *page, int *offset) {
+  auto [exist, first_page] = seat_matrix_.GetValue(key.first);
+  if (exist) RowOf(key, shape, first_page, page, offset);
+  return exist;
+}
+void SeatStore::RowOf(const Key &key, const SeatShape &shape, int first_page, int *page, int *offset) {
+  int row_bytes = RowBytes(shape), rows_per_page = kPageSize / row_bytes;
+  int day = (key.second.minutes() - shape.start_sale.minutes()) / kOneDay.minutes();
+  *page = first_page + day / rows_per_page;
+  *offset = day % rows_per_page * row_bytes;
+}
+void SeatStore::AllocateMatrix(TrainIdHash train_id_hash, const SeatShape &shape) {
+  int row_bytes = RowBytes(shape), rows_per_page = kPageSize / row_bytes;
+  int days = (shape.end_sale.minutes() - shape.start_sale.minutes()) / kOneDay.minutes() + 1;
+  int pages = (days + rows_per_page - 1) / rows_per_page;
+  int first_page = seat_pages_.Allocate(pages);
+  TrainSeats full(shape.seat_num, shape.station_num);
+  for (int i = 0; i < pages; ++i) {
+    auto page = seat_pages_.Create(first_page + i);
+    memset(page->data, 0, kPageSize);
+    for (int row = 0; row < rows_per_page; ++row)
+      Pack(full, shape.station_num - 1, Narrow(shape), page->data + row * row_bytes);
+  }
+  seat_matrix_.Insert(train_id_hash, first_page);
+}
+
+bool SeatStore::Get(const Key &key, const SeatShape &shape, TrainSeats *seats) {
+  if (layout_ == SeatLayout::kMatrix) {
+    int page, offset;
+    if (!FindRow(key, shape, &page, &offset)) return false;
+    Unpack(seat_pages_.Fetch(page)->data + offset, shape.station_num - 1, Narrow(shape), seats);
+    return true;
+  }
+  return WithTree(shape, [&](auto &tree, bool narrow) {
+    auto [exist, record] = tree.GetValue(key);
+    if (exist) Unpack(record.data, shape.station_num - 1, narrow, seats);
+    return exist;
+  });
 }
-void TrainSeats::RangeAdd(int l, int r, int x) {
-  for (int i = l; i < r; ++i) seat_num[i] += x;
+void SeatStore::Put(const Key &key, const SeatShape &shape, const TrainSeats &seats) {
+  if (layout_ == SeatLayout::kMatrix) {
+    int page, offset;
+    if (!FindRow(key, shape, &page, &offset)) {
+      AllocateMatrix(key.first, shape);
+      FindRow(key, shape, &page, &offset);
+    }
+    auto guard = seat_pages_.Fetch(page);
+    Pack(seats, shape.station_num - 1, Narrow(shape), guard->data + offset);
+    guard.MarkDirty();
+    return;
+  }
+  WithTree(shape, [&](auto &tree, bool narrow) {
+    decltype(tree.GetValue(key).second) record = {};
+    Pack(seats, shape.station_num - 1, narrow, record.data);
+    return tree.Upsert(key, record);
+  });
+}
+void SeatStore::RangeMin(const vector<Range> &ranges, vector<int> *ans) {
+  size_t first = ans->size();
+  for (size_t i = 0; i < ranges.size(); ++i) ans->push_back(ranges[i].shape.seat_num);
+  TrainSeats seats;
+  if (layout_ == SeatLayout::kMatrix) {
+    vector<TrainIdHash> trains;
+    for (size_t i = 0; i < ranges.size(); ++i) trains.push_back(ranges[i].key.first);
+    seat_matrix_.MultiGet(trains, [&](int i, int first_page) {
+      const Range &range = ranges[i];
+      int page, offset;
+      RowOf(range.key, range.shape, first_page, &page, &offset);
+      Unpack(seat_pages_.Fetch(page)->data + offset, range.r, Narrow(range.shape), &seats);
+      (*ans)[first + i] = seats.RangeMin(range.l, range.r);
+    });
+    return;
+  }
+  // 按记录所在的树分组，每组一趟
+  vector<int> groups[kSizeClasses];
+  for (size_t i = 0; i < ranges.size(); ++i) groups[SizeClass(ranges[i].shape)].push_back(i);
+  for (auto &group : groups) {
+    if (group.empty()) continue;
+    WithTree(ranges[group[0]].shape, [&](auto &tree, bool) {
+      vector<Key> keys;
+      for (int i : group) keys.push_back(ranges[i].key);
+      tree.MultiGet(keys, [&](int k, const auto &record) {
+        const Range &range = ranges[group[k]];
+        Unpack(record.data, range.r, Narrow(range.shape), &seats);
+        (*ans)[first + group[k]] = seats.RangeMin(range.l, range.r);
+      });
+      return true;
+    });
+  }
+}
+template <class Fn>
+bool SeatStore::Update(const Key &key, const SeatShape &shape, Fn fn) {
+  TrainSeats seats;
+  if (layout_ == SeatLayout::kMatrix) {
+    int page, offset;
+    if (!FindRow(key, shape, &page, &offset)) return false;
+    auto guard = seat_pages_.Fetch(page);
+    Unpack(guard->data + offset, shape.station_num - 1, Narrow(shape), &seats);
+    fn(seats);
+    Pack(seats, shape.station_num - 1, Narrow(shape), guard->data + offset);
+    guard.MarkDirty();
+    return true;
+  }
+  return WithTree(shape, [&](auto &tree, bool narrow) {
+    return tree.Update(key, [&](auto &record) {
+      Unpack(record.data, shape.station_num - 1, narrow, &seats);
+      fn(seats);
+      Pack(seats, shape.station_num - 1, narrow, record.data);
+    });
+  });
 }
 
 bool CompareTime(const Ticket &a, const Ticket &b) {
@@ -74,7 +255,7 @@ TransferTicket::TransferTicket() : duration(INT_MAX), cost(INT_MAX) {}
 bool CompareTime(const TransferTicket &a, const TransferTicket &b) {
   if (a.duration == b.duration) {
     if (a.cost == b.cost) {
-      if (a.ticket1.train_id == b.ticket2.train_id) {
+      if (a.ticket1.train_id == b.ticket1.train_id) {
         return a.ticket2.train_id < b.ticket2.train_id;
       } else {
         return a.ticket1.train_id < b.ticket1.train_id;
@@ -91,7 +272,7 @@ bool CompareTime(const TransferTicket &a, const TransferTicket &b) {
 bool CompareCost(const TransferTicket &a, const TransferTicket &b) {
   if (a.cost == b.cost) {
     if (a.duration == b.duration) {
-      if (a.ticket1.train_id == b.ticket2.train_id) {
+      if (a.ticket1.train_id == b.ticket1.train_id) {
         return a.ticket2.train_id < b.ticket2.train_id;
       } else {
         return a.ticket1.train_id < b.ticket1.train_id;
@@ -106,7 +287,7 @@ bool CompareCost(const TransferTicket &a, const TransferTicket &b) {
   //        Tuple(b.cost, b.duration, b.ticket1.train_id, b.ticket2.train_id);
 }
 
-std::string Order::ToString() const {
+std::string Order::ToString(const StationDict &stations) const {
   std::string ret;
   switch (status) {
     case SUCCESS:
@@ -122,62 +303,181 @@ std::string Order::ToString() const {
       throw Exception();
       break;
   }
-  append(ret, ' ', train_id.c_str(), ' ', from_station.c_str(), ' ', dep_datetime.ToString(), " -> ",
-      to_station.c_str(), ' ', arr_datetime.ToString(), ' ', std::to_string(cost), ' ', std::to_string(num));
+  append(ret, ' ', train_id.c_str(), ' ', stations.Name(from_station), ' ', dep_datetime.ToString(), " -> ",
+      stations.Name(to_station), ' ', arr_datetime.ToString(), ' ', std::to_string(cost), ' ', std::to_string(num));
   return ret;
 }
 
+StationDict::StationDict(const std::string &filename) : file_(filename) {
+  for (size_t offset = huang::HeapFile::kHeaderSize; offset < file_.End();) {
+    uint16_t length;
+    memcpy(&length, file_.Get(offset), sizeof(length));
+    std::string_view name(file_.Get(offset) + sizeof(length), length);
+    ids_[name] = names_.size();
+    names_.push_back(name);
+    offset = (offset + sizeof(length) + length + 7) & ~static_cast<size_t>(7);  // 与 HeapFile::Append 的对齐一致
+  }
+}
+
+StationId StationDict::Intern(std::string_view name) {
+  StationId id = Find(name);
+  if (id != kNoStation) return id;
+  std::string record(sizeof(uint16_t), '\0');
+  uint16_t length = name.length();
+  memcpy(record.data(), &length, sizeof(length));
+  record.append(name);
+  size_t offset = file_.Append(record.data(), record.size());
+  name = std::string_view(file_.Get(offset) + sizeof(length), length);
+  id = names_.size();
+  ids_[name] = id;
+  names_.push_back(name);
+  return id;
+}
+
+StationId StationDict::Find(std::string_view name) {
+  auto it = ids_.find(name);
+  return it == ids_.end() ? kNoStation : it->second;
+}
+
+TrainView::TrainView(const char *data) {
+  head_ = reinterpret_cast<const TrainHead *>(data);
+  int n = head_->station_num;
+  sum_prices_ = reinterpret_cast<const int *>(data + sizeof(TrainHead));
+  arrival_times_ = reinterpret_cast<const Time *>(sum_prices_ + n);
+  departure_times_ = arrival_times_ + n;
+  station_ids_ = reinterpret_cast<const StationId *>(departure_times_ + n);
+}
+
+std::string TrainView::Encode(const Train &train, const StationId *station_ids) {
+  int n = train.station_num;
+  TrainHead head;
+  head.id = train.id;
+  head.type = train.type;
+  head.seat_num = train.seat_num;
+  head.station_num = n;
+  head.start_sale = train.start_sale;
+  head.end_sale = train.end_sale;
+  std::string ret(reinterpret_cast<const char *>(&head), sizeof(head));
+  ret.append(reinterpret_cast<const char *>(train.sum_prices), n * sizeof(int));
+  ret.append(reinterpret_cast<const char *>(train.arrival_times), n * sizeof(Time));
+  ret.append(reinterpret_cast<const char *>(train.departure_times), n * sizeof(Time));
+  ret.append(reinterpret_cast<const char *>(station_ids), n * sizeof(StationId));
+  return ret;
+}
+
+TrainManager::TrainManager(size_t pair_index_budget, SeatLayout seat_layout)
+    : train_seats_(seat_layout),
+      pair_budget_(pair_index_budget / sizeof(std::pair<PairTrainKey, PairTrain>)),
+      pair_index_on_(!pair_trains_.GetValue(kStalePairIndex).first) {}
+
+TrainRecord TrainManager::PutTrain(const Train &train, bool released) {
+  StationId station_ids[Train::kMaxStationNum];
+  for (int i = 0; i < train.station_num; ++i) station_ids[i] = stations_.Intern(train.stations[i].c_str());
+  std::string data = TrainView::Encode(train, station_ids);
+  return {train_heap_.Append(data.data(), data.size()), static_cast<int>(data.size()), released, train.seat_num,
+      train.station_num, train.start_sale, train.end_sale};
+}
+
 std::string TrainManager::AddTrain(const Train &train) {
   auto train_id_hash = TrainIdHasher(train.id);
   bool exist = trains_.GetValue(train_id_hash).first;
   if (exist) return "-1";
-  trains_.Insert(train_id_hash, train);
+  trains_.Insert(train_id_hash, PutTrain(train, false));
   return "0";
 }
 
 std::string TrainManager::DeleteTrain(std::string_view train_id) {
   auto train_id_hash = TrainIdHasher(train_id);
-  auto [exist, train] = trains_.GetValue(train_id_hash);
+  auto [exist, record] = trains_.GetValue(train_id_hash);
   if (!exist) return "-1";  // 车次不存在
-  if (train.released) return "-1";  // 不能删除已发布的车次
-  trains_.Remove(train_id_hash);
+  if (record.released) return "-1";  // 不能删除已发布的车次
+  trains_.Remove(train_id_hash);  // 堆文件里的旧记录不再回收
   return "0";
 }
 
 std::string TrainManager::ReleaseTrain(std::string_view train_id) {
-  auto train_id_hash = TrainIdHasher(train_id);
-  auto [exist, train] = trains_.GetValue(train_id_hash);
-  if (!exist) return "-1";  // 车次不存在
-  if (train.released) return "-1";  // 不可重复 release
-  train.released = true;
-  for (int i = 0; i < train.station_num; ++i) {
-    station_trains_.Insert(std::make_pair(StationHasher(train.stations[i]), train_id_hash),
-        StationTrain(train_id_hash, train.arrival_times[i], train.departure_times[i], train.sum_prices[i], i, train));
+  vector<std::string_view> train_ids;
+  train_ids.push_back(train_id);
+  return Release(train_ids) == 1 ? "0" : "-1";  // 车次不存在，或不可重复 release
+}
+
+std::string TrainManager::ReleaseTrains(const vector<std::string_view> &train_ids) {
+  return std::to_string(Release(train_ids));
+}
+
+int TrainManager::Release(const vector<std::string_view> &train_ids) {
+  vector<TrainIdHash> hashes;
+  for (size_t i = 0; i < train_ids.size(); ++i) hashes.push_back(TrainIdHasher(train_ids[i]));
+  // 同一车次出现多次时，只有第一次发布成功
+  vector<std::pair<TrainIdHash, TrainRecord>> released;
+  trains_.MultiUpdate(hashes, [&](int i, TrainRecord &record) {
+    if (record.released) return;
+    record.released = true;
+    released.push_back({hashes[i], record});
+  });
+  vector<std::pair<std::pair<StationId, TrainIdHash>, StationTrain>> station_pairs;
+  vector<std::pair<TrainIdHash, TrainView>> views;
+  for (size_t k = 0; k < released.size(); ++k) {
+    TrainIdHash train_id_hash = released[k].first;
+    TrainView train = GetTrain(released[k].second);
+    for (int i = 0; i < train.station_num(); ++i) {
+      station_pairs.push_back({std::make_pair(train.station(i), train_id_hash),
+          StationTrain(train.arrival_time(i), train.departure_time(i), train.sum_price(i), i, train.head())});
+    }
+    views.push_back({train_id_hash, train});
   }
-  trains_.Modify(train_id_hash, train);
-  return "0";
+  station_trains_.MultiInsert(station_pairs);
+  IndexPairs(views);
+  return released.size();
+}
+
+std::string TrainManager::ImportTrains(vector<Train> &trains) {
+  huang::flat_hashmap<TrainIdHash, int> seen;
+  vector<std::pair<TrainIdHash, TrainRecord>> train_pairs;
+  vector<std::pair<std::pair<StationId, TrainIdHash>, StationTrain>> station_pairs;
+  vector<std::pair<TrainIdHash, TrainView>> views;
+  for (auto &train : trains) {
+    auto train_id_hash = TrainIdHasher(train.id);
+    if (seen.count(train_id_hash) || trains_.GetValue(train_id_hash).first) continue;
+    seen[train_id_hash] = 1;
+    TrainRecord record = PutTrain(train, true);
+    TrainView view = GetTrain(record);
+    for (int i = 0; i < view.station_num(); ++i) {
+      station_pairs.push_back({std::make_pair(view.station(i), train_id_hash),
+          StationTrain(view.arrival_time(i), view.departure_time(i), view.sum_price(i), i, view.head())});
+    }
+    views.push_back({train_id_hash, view});
+    train_pairs.push_back({train_id_hash, record});
+  }
+  trains_.BulkLoad(train_pairs);
+  station_trains_.BulkLoad(station_pairs);
+  IndexPairs(views);
+  return std::to_string(train_pairs.size());
 }
 
 std::string TrainManager::QueryTrain(std::string_view train_id, Date target_date) {
   auto train_id_hash = TrainIdHasher(train_id);
-  auto [exist, train] = trains_.GetValue(train_id_hash);
+  auto [exist, record] = trains_.GetValue(train_id_hash);
   if (!exist) return "-1";  // 车次不存在
-  if (target_date < train.start_sale || train.end_sale < target_date) return "-1";  // 超出日期范围
+  if (target_date < record.start_sale || record.end_sale < target_date) return "-1";  // 超出日期范围
+  TrainView train = GetTrain(record);
+  const TrainHead &head = train.head();
+  int station_num = train.station_num();
   std::string ret;
-  append(ret, train_id, ' ', train.type, '\n');
-  auto seats = GetSeats(train_id_hash, target_date, train.seat_num, train.station_num);
-  append(ret, train.stations[0].c_str(), " xx-xx xx:xx -> ",  //
-      DateTime(target_date, train.departure_times[0]).ToString(), ' ',  //
-      std::to_string(train.sum_prices[0]), ' ', std::to_string(seats[0]), '\n');
-  for (int i = 1; i < train.station_num - 1; ++i) {
-    append(ret, train.stations[i].c_str(), ' ',  //
-        DateTime(target_date, train.arrival_times[i]).ToString(), " -> ",
-        DateTime(target_date, train.departure_times[i]).ToString(), ' ',  //
-        std::to_string(train.sum_prices[i]), ' ', std::to_string(seats[i]), '\n');
-  }
-  append(ret, train.stations[train.station_num - 1].c_str(), ' ',
-      DateTime(target_date, train.arrival_times[train.station_num - 1]).ToString(), " -> xx-xx xx:xx ",
-      std::to_string(train.sum_prices[train.station_num - 1]), " x");
+  append(ret, train_id, ' ', head.type, '\n');
+  auto seats = GetSeats(train_id_hash, target_date, SeatShape::Of(head));
+  append(ret, stations_.Name(train.station(0)), " xx-xx xx:xx -> ",  //
+      DateTime(target_date, train.departure_time(0)).ToString(), ' ',  //
+      std::to_string(train.sum_price(0)), ' ', std::to_string(seats[0]), '\n');
+  for (int i = 1; i < station_num - 1; ++i) {
+    append(ret, stations_.Name(train.station(i)), ' ',  //
+        DateTime(target_date, train.arrival_time(i)).ToString(), " -> ",
+        DateTime(target_date, train.departure_time(i)).ToString(), ' ',  //
+        std::to_string(train.sum_price(i)), ' ', std::to_string(seats[i]), '\n');
+  }
+  append(ret, stations_.Name(train.station(station_num - 1)), ' ',
+      DateTime(target_date, train.arrival_time(station_num - 1)).ToString(), " -> xx-xx xx:xx ",
+      std::to_string(train.sum_price(station_num - 1)), " x");
   return ret;
 }
 
@@ -198,44 +498,129 @@ template <class T>
 using ComparisonOf = bool (*)(const T &, const T &);
 }  // namespace
 
-TrainSeatsWrap TrainManager::GetSeats(TrainIdHash train_id_hash, Date date, int initial_seat_num, int station_num) {
-  auto [success, seats] = train_seats_.GetValue(std::make_pair(train_id_hash, date));
-  if (success)
-    return TrainSeatsWrap(seats);
-  else
-    return TrainSeatsWrap(initial_seat_num, station_num);
+void TrainManager::IndexPairs(const vector<std::pair<TrainIdHash, TrainView>> &trains) {
+  if (!pair_index_on_ || trains.empty()) return;
+  if (pair_budget_ == 0) {
+    // 这些车次不进索引，以后即使再打开站对索引也不能用了
+    pair_trains_.Insert(kStalePairIndex, PairTrain());
+    pair_index_on_ = false;
+    return;
+  }
+  vector<std::pair<PairTrainKey, PairTrain>> pairs;
+  for (size_t k = 0; k < trains.size(); ++k) {
+    const TrainView &train = trains[k].second;
+    for (int i = 0; i < train.station_num(); ++i)
+      for (int j = i + 1; j < train.station_num(); ++j)
+        pairs.push_back({PairTrainKey(train.station(i), train.station(j), trains[k].first), PairTrain(train, i, j)});
+  }
+  Sort(pairs.begin(), pairs.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+  // 每个站对一组，一趟查出已经回退到归并的站对
+  vector<size_t> begins;
+  vector<PairTrainKey> overflows;
+  vector<int> fallen;
+  for (size_t k = 0; k < pairs.size(); ++k) {
+    StationId from = pairs[k].first.get<0>(), to = pairs[k].first.get<1>();
+    if (k > 0 && pairs[k - 1].first.get<0>() == from && pairs[k - 1].first.get<1>() == to) continue;
+    begins.push_back(k);
+    overflows.push_back(PairTrainKey(from, to, kHashMin));
+    fallen.push_back(0);
+  }
+  begins.push_back(pairs.size());
+  pair_trains_.MultiGet(overflows, [&](int g, const PairTrain &) { fallen[g] = 1; });
+  // 按站对顺序整组放入；预算用完后，放不下的站对把已有的项全部移出，只留回退标记
+  bool empty = pair_trains_.Empty();
+  size_t used = pair_trains_.Size();
+  vector<std::pair<PairTrainKey, PairTrain>> admitted;
+  vector<PairTrainKey> evicted;
+  for (size_t g = 0; g < overflows.size(); ++g) {
+    if (fallen[g]) continue;
+    size_t begin = begins[g], end = begins[g + 1];
+    if (used + (end - begin) <= pair_budget_) {
+      for (size_t k = begin; k < end; ++k) admitted.push_back(pairs[k]);
+      used += end - begin;
+      continue;
+    }
+    StationId from = overflows[g].get<0>(), to = overflows[g].get<1>();
+    for (auto it = pair_trains_.SeekForward(overflows[g]);
+         it.Valid() && it->first.get<0>() == from && it->first.get<1>() == to; it.Next()) {
+      evicted.push_back(it->first);
+      --used;
+    }
+    admitted.push_back({overflows[g], PairTrain()});
+    ++used;
+  }
+  if (empty) {
+    pair_trains_.BulkLoad(admitted, true);
+  } else {
+    pair_trains_.MultiRemove(evicted);
+    pair_trains_.MultiInsert(admitted);
+  }
+}
+
+bool TrainManager::QueryPairIndex(Date date, StationId from_id, StationId to_id, vector<Ticket> &result,
+    vector<SeatStore::Range> &seat_ranges) {
+  if (!UsePairIndex()) return false;
+  auto it = pair_trains_.SeekForward(PairTrainKey(from_id, to_id, kHashMin));
+  auto same_pair = [&] { return it.Valid() && it->first.get<0>() == from_id && it->first.get<1>() == to_id; };
+  if (same_pair() && it->first.get<2>() == kHashMin) return false;  // 站对超出预算
+  for (; same_pair(); it.Next()) AddDirectTicket(result, seat_ranges, date, it->first.get<2>(), it->second);
+  return true;
+}
+
+void TrainManager::AddDirectTicket(vector<Ticket> &result, vector<SeatStore::Range> &seat_ranges, Date date,
+    TrainIdHash train_id_hash, const PairTrain &train) {
+  Date start_date = date - train.departure_time.GetDays();
+  if (start_date < train.start_sale || train.end_sale < start_date) return;  // 超出售票日期
+  result.push_back({train.train_id, start_date + train.departure_time, start_date + train.arrival_time,
+      train.arrival_time - train.departure_time, train.price, 0});
+  seat_ranges.push_back(
+      {std::make_pair(train_id_hash, start_date), SeatShape::Of(train), train.from_rank, train.to_rank});
+}
+
+TrainSeatsWrap TrainManager::GetSeats(TrainIdHash train_id_hash, Date date, const SeatShape &shape) {
+  TrainSeatsWrap seats(shape.seat_num, shape.station_num);
+  seats.exist = train_seats_.Get(std::make_pair(train_id_hash, date), shape, &seats);
+  return seats;
 }
-void TrainManager::UpdateSeats(TrainIdHash train_id_hash, Date date, const TrainSeatsWrap &seats) {
-  auto key = std::make_pair(train_id_hash, date);
-  auto [success, old_seats] = train_seats_.GetValue(key);
-  if (success)
-    // *seats_ptr = *seats.seats;
-    train_seats_.Modify(key, TrainSeats(seats));
-  else
-    train_seats_.Insert(key, TrainSeats(seats));
+void TrainManager::UpdateSeats(
+    TrainIdHash train_id_hash, Date date, const SeatShape &shape, const TrainSeatsWrap &seats) {
+  train_seats_.Put(std::make_pair(train_id_hash, date), shape, seats);
 }
 
 std::string TrainManager::QueryTicket(
     Date date, std::string_view from_station, std::string_view to_station, SortOrder sort_order) {
-  auto from_hash = StationHasher(from_station), to_hash = StationHasher(to_station);
-  vector<StationTrain> start_trains, end_trains;
-  station_trains_.GetValue(std::make_pair(from_hash, kHashMin), std::make_pair(from_hash, kHashMax), &start_trains);
-  if (start_trains.empty()) return "0";
-  station_trains_.GetValue(std::make_pair(to_hash, kHashMin), std::make_pair(to_hash, kHashMax), &end_trains);
-  if (end_trains.empty()) return "0";
+  StationId from_id = stations_.Find(from_station), to_id = stations_.Find(to_station);
+  if (from_id == StationDict::kNoStation || to_id == StationDict::kNoStation) return "0";
   vector<Ticket> result;
-  for (auto i = start_trains.begin(), j = end_trains.begin(); i != start_trains.end(); ++i) {
-    while (j != end_trains.end() && j->train_id_hash < i->train_id_hash) ++j;
-    if (j == end_trains.end()) break;
-    if (i->train_id != j->train_id) continue;
-    if (i->rank >= j->rank) continue;  // 列车运行方向不符
-    Date start_date = date - i->departure_time.GetDays();
-    if (start_date < i->start_sale || i->end_sale < start_date) continue;  // 超出售票日期
-    auto seats = GetSeats(i->train_id_hash, start_date, i->seat_num, i->station_num);
-    result.push_back({i->train_id, start_date + i->departure_time, start_date + j->arrival_time,
-        j->arrival_time - i->departure_time, j->sum_price - i->sum_price, seats.RangeMin(i->rank, j->rank)});
+  vector<SeatStore::Range> seat_ranges;  // 与 result 一一对应
+  if (!QueryPairIndex(date, from_id, to_id, result, seat_ranges)) {
+    // 两个车站的车次都按 train_id_hash 有序，直接在叶子链上归并，不把整段结果拷贝出来。
+    // 项里只有时刻、票价和售票日期，通过日期过滤的车次再一起去 trains_ 里找车头，取车次名和座位数
+    vector<TrainIdHash> matched;
+    vector<std::pair<StationTrain, StationTrain>> legs;  // 与 matched 一一对应
+    auto i_it = station_trains_.SeekForward(std::make_pair(from_id, kHashMin));
+    auto j_it = station_trains_.SeekForward(std::make_pair(to_id, kHashMin));
+    for (; i_it.Valid() && i_it->first.first == from_id; i_it.Next()) {
+      while (j_it.Valid() && j_it->first.first == to_id && j_it->first.second < i_it->first.second) j_it.Next();
+      if (!j_it.Valid() || j_it->first.first != to_id) break;
+      if (i_it->first.second != j_it->first.second) continue;
+      const StationTrain &i = i_it->second, &j = j_it->second;
+      if (i.rank >= j.rank) continue;  // 列车运行方向不符
+      Date start_date = date - i.departure_time.GetDays();
+      if (start_date < i.start_sale() || i.end_sale() < start_date) continue;  // 超出售票日期
+      matched.push_back(i_it->first.second);
+      legs.push_back({i, j});
+    }
+    trains_.MultiGet(matched, [&](int k, const TrainRecord &record) {
+      const TrainHead &head = GetTrain(record).head();
+      AddDirectTicket(result, seat_ranges, date, matched[k], PairTrain(head, legs[k].first, legs[k].second));
+    });
   }
   if (result.empty()) return "0";
+  // 余票最后一起查，每棵树上的键排好序一趟查完
+  vector<int> seats;
+  train_seats_.RangeMin(seat_ranges, &seats);
+  for (size_t k = 0; k < result.size(); ++k) result[k].seat = seats[k];
   if (sort_order == SortOrder::TIME) {
     Sort(result.begin(), result.end(), ComparisonOf<Ticket>(CompareTime));
   } else {
@@ -251,70 +636,50 @@ std::string TrainManager::QueryTicket(
 
 std::string TrainManager::QueryTransfer(
     Date date, std::string_view from_station, std::string_view to_station, SortOrder sort_order) {
-  auto from_hash{StationHasher(from_station)}, to_hash{StationHasher(to_station)};
+  StationId from_id = stations_.Find(from_station), to_id = stations_.Find(to_station);
+  if (from_id == StationDict::kNoStation || to_id == StationDict::kNoStation) return "0";
+  // 出发站的车次先按项里的售票日期过滤，留下的和到达站的车次再各用一趟 MultiGet 取出记录，每趟车只读一次堆文件
   vector<StationTrain> start_trains, end_trains;
-  station_trains_.GetValue(std::make_pair(from_hash, kHashMin), std::make_pair(from_hash, kHashMax), &start_trains);
+  vector<TrainIdHash> start_hashes, end_hashes;
+  for (auto it = station_trains_.SeekForward(std::make_pair(from_id, kHashMin));
+       it.Valid() && it->first.first == from_id; it.Next()) {
+    const StationTrain &i = it->second;
+    Date i_start_date = date - i.departure_time.GetDays();
+    if (i_start_date < i.start_sale() || i.end_sale() < i_start_date) continue;
+    start_trains.push_back(i);
+    start_hashes.push_back(it->first.second);
+  }
   if (start_trains.empty()) return "0";
-  station_trains_.GetValue(std::make_pair(to_hash, kHashMin), std::make_pair(to_hash, kHashMax), &end_trains);
+  for (auto it = station_trains_.SeekForward(std::make_pair(to_id, kHashMin));
+       it.Valid() && it->first.first == to_id; it.Next()) {
+    end_trains.push_back(it->second);
+    end_hashes.push_back(it->first.second);
+  }
   if (end_trains.empty()) return "0";
 
-  TransferTicket ans, cur;
-  ans.duration = Duration(INT_MAX);
-  ans.cost = INT_MAX;
-  bool found = false;
+  // 键是有序的，MultiGet 按下标顺序回调；堆文件的映射不会移动
+  vector<TransferLeg> start, end;
+  trains_.MultiGet(start_hashes, [&](int k, const TrainRecord &record) {
+    start.push_back({&start_trains[k], start_hashes[k], GetTrain(record)});
+  });
+  trains_.MultiGet(end_hashes, [&](int k, const TrainRecord &record) {
+    end.push_back({&end_trains[k], end_hashes[k], GetTrain(record)});
+  });
+  TransferPlan plan = TransferEngine(date, sort_order, start, end).Solve();
+  if (!plan.found) return "0";
+  TransferTicket &ans = plan.ticket;
+  const TransferLeg &i = start[plan.first], &j = end[plan.second];
+  ans.transfer_station = stations_.Name(plan.transfer_station);
+  vector<SeatStore::Range> seat_ranges;
+  seat_ranges.push_back({std::make_pair(i.train_id_hash, plan.start_date1), SeatShape::Of(i.view.head()),
+      i.train->rank, plan.transfer_rank1});
+  seat_ranges.push_back({std::make_pair(j.train_id_hash, plan.start_date2), SeatShape::Of(j.view.head()),
+      plan.transfer_rank2, j.train->rank});
+  vector<int> seats;
+  train_seats_.RangeMin(seat_ranges, &seats);
+  ans.ticket1.seat = seats[0];
+  ans.ticket2.seat = seats[1];
 
-  for (auto i : start_trains) {
-    Date i_start_date = date - i.departure_time.GetDays();
-    if (i_start_date < i.start_sale || i.end_sale < i_start_date) continue;
-    Train i_train = trains_.GetValue(i.train_id_hash).second;
-    std::unordered_map<StationHash, int> station_rank;
-    for (int k = i.rank + 1; k < i_train.station_num; ++k) station_rank[StationHasher(i_train.stations[k])] = k;
-    for (auto j : end_trains) {
-      if (i.train_id == j.train_id) continue;
-      Train j_train = trains_.GetValue(j.train_id_hash).second;  // TODO: 检查指针不会失效
-      for (int k = 0; k < j.rank; ++k) {
-        auto &transfer_station = j_train.stations[k];
-        auto transfet_station_hash = StationHasher(transfer_station);
-        auto iter = station_rank.find(transfet_station_hash);
-        if (iter == station_rank.end()) continue;
-        DateTime i_arr_datetime = i_start_date + i_train.arrival_times[iter->second];
-        auto [i_arr_date, i_arr_time] = i_arr_datetime.GetDateAndTime();
-        auto [j_dep_days, j_dep_time] = j_train.departure_times[k].GetDayTime();
-        // j_start_date 为 j 车可行的最早发车日期，由于可以在中转站停留任意长的时间，故只需要计算最早发车日期
-        Date j_start_date = i_arr_date - j_dep_days;
-        if (j_dep_time < i_arr_time) j_start_date += kOneDay;
-        j_start_date = std::max(j_start_date, j_train.start_sale);  // 发车日期不能早于开始售票的日期
-        if (j.end_sale < j_start_date) continue;
-
-        DateTime j_dep_datetime = j_start_date + j_train.departure_times[k];
-        cur.ticket1.train_id = i.train_id;
-        cur.ticket1.cost = i_train.sum_prices[iter->second] - i.sum_price;
-        cur.ticket2.train_id = j.train_id;
-        cur.ticket2.cost = j.sum_price - j_train.sum_prices[k];
-        cur.cost = cur.ticket1.cost + cur.ticket2.cost;
-        cur.duration = (i_train.arrival_times[iter->second] - i_train.departure_times[i.rank]) +
-                       (j_train.arrival_times[j.rank] - j_train.departure_times[k]) + (j_dep_datetime - i_arr_datetime);
-
-        bool is_better = sort_order == SortOrder::TIME ? CompareTime(cur, ans) : CompareCost(cur, ans);
-        found = true;
-
-        if (is_better) {
-          ans = cur;  // TODO: optimize
-          ans.transfer_station = transfer_station.str();
-          ans.ticket1.start_time = i_start_date + i.departure_time;
-          ans.ticket1.end_time = i_arr_datetime;
-          auto i_seats = GetSeats(i.train_id_hash, i_start_date, i.seat_num, i.station_num);
-          ans.ticket1.seat = i_seats.RangeMin(i.rank, iter->second);
-
-          ans.ticket2.start_time = j_dep_datetime;
-          ans.ticket2.end_time = j_start_date + j.arrival_time;
-          auto j_seats = GetSeats(j.train_id_hash, j_start_date, j.seat_num, j.station_num);
-          ans.ticket2.seat = j_seats.RangeMin(k, j.rank);
-        }
-      }
-    }
-  }
-  if (!found) return "0";
   std::string ret;
   append(ret, ans.ticket1.train_id.c_str(), ' ', from_station, ' ', ans.ticket1.start_time.ToString(), " -> ",
       ans.transfer_station, ' ' + ans.ticket1.end_time.ToString(), ' ', std::to_string(ans.ticket1.cost), ' ',
@@ -329,16 +694,18 @@ std::string TrainManager::BuyTicket(int timestamp, std::string_view username, st
     const int number, std::string_view from_station, std::string_view to_station, const bool pending) {
   auto user_id_hash = UserIdHasher(username);
   auto train_id_hash = TrainIdHasher(train_id);
-  auto from_hash = StationHasher(from_station), to_hash = StationHasher(to_station);
-  auto [exist_from_st_train, from_st_train] = station_trains_.GetValue(std::make_pair(from_hash, train_id_hash));
+  StationId from_id = stations_.Find(from_station), to_id = stations_.Find(to_station);
+  if (from_id == StationDict::kNoStation || to_id == StationDict::kNoStation) return "-1";
+  auto [exist_from_st_train, from_st_train] = station_trains_.GetValue(std::make_pair(from_id, train_id_hash));
   if (!exist_from_st_train) return "-1";
   Date start_date = date - from_st_train.departure_time.GetDays();
-  if (start_date < from_st_train.start_sale || from_st_train.end_sale < start_date || from_st_train.seat_num < number)
-    return "-1";
-  auto [exist_to_st_train, to_st_train] = station_trains_.GetValue(std::make_pair(to_hash, train_id_hash));
+  if (start_date < from_st_train.start_sale() || from_st_train.end_sale() < start_date) return "-1";
+  auto [exist_to_st_train, to_st_train] = station_trains_.GetValue(std::make_pair(to_id, train_id_hash));
   if (!exist_to_st_train) return "-1";
   if (from_st_train.rank >= to_st_train.rank) return "-1";
-  TrainSeatsWrap seats = GetSeats(train_id_hash, start_date, from_st_train.seat_num, from_st_train.station_num);
+  SeatShape shape = SeatShape::Of(trains_.GetValue(train_id_hash).second);
+  if (shape.seat_num < number) return "-1";
+  TrainSeatsWrap seats = GetSeats(train_id_hash, start_date, shape);
   int avail_seats = seats.RangeMin(from_st_train.rank, to_st_train.rank);
   if (avail_seats < number && !pending) return "-1";
   /*
@@ -348,71 +715,105 @@ std::string TrainManager::BuyTicket(int timestamp, std::string_view username, st
     Date start_date;
     User::IdType username;
     Train::IdType train_id;
-    Train::StationName from_station, to_station;
+    StationId from_station, to_station;
     int from_rank, to_rank;
     DateTime dep_datetime, arr_datetime;
   };
   */
+  int seq = OrderCount(user_id_hash) + 1;
   Order order = {Order::Status::SUCCESS, timestamp,  //
       to_st_train.sum_price - from_st_train.sum_price, number,  //
       start_date, username, train_id,  //
-      from_station, to_station, from_st_train.rank, to_st_train.rank,  //
+      from_id, to_id, from_st_train.rank, to_st_train.rank,  //
       start_date + from_st_train.departure_time, start_date + to_st_train.arrival_time};
   std::string ret;
   if (avail_seats >= number) {
     seats.RangeAdd(from_st_train.rank, to_st_train.rank, -number);
-    UpdateSeats(train_id_hash, start_date, seats);
+    UpdateSeats(train_id_hash, start_date, shape, seats);
     ret = std::to_string(1ll * number * (to_st_train.sum_price - from_st_train.sum_price));
   } else {
     order.status = Order::Status::PENDING;
-    PendingOrder pending_order = {timestamp, number, from_st_train.rank, to_st_train.rank, user_id_hash};
-    pending_orders_.Insert(Tuple(train_id_hash, start_date, timestamp), pending_order);
+    PendingOrder pending_order = {timestamp, number, from_st_train.rank, to_st_train.rank, user_id_hash, seq};
+    pending_orders_.Push(train_id_hash, start_date, pending_order);
     ret = "queue";
   }
-  orders_.Insert(std::make_pair(user_id_hash, -timestamp), order);
+  orders_.Insert(std::make_pair(user_id_hash, -seq), order);
   return ret;
 }
 
+int TrainManager::OrderCount(UserIdHash user_id_hash) {
+  auto it = orders_.SeekForward(std::make_pair(user_id_hash, INT_MIN));
+  return it.Valid() && it->first.first == user_id_hash ? -it->first.second : 0;
+}
+
+void PendingQueue::Push(TrainIdHash train_id_hash, Date date, const PendingOrder &order) {
+  queue_.Insert(Key(train_id_hash, date, order.timestamp), order);
+}
+void PendingQueue::Erase(TrainIdHash train_id_hash, Date date, int timestamp) {
+  queue_.Remove(Key(train_id_hash, date, timestamp));
+}
+void PendingQueue::Fill(TrainIdHash train_id_hash, Date date, int l, int r, int num, TrainSeats *seats,
+    vector<PendingOrder> *filled) {
+  // freed[k - l] 是第 k 段退回的座位还剩几个；每段都用完后余票不比退票前多，剩下的订单都补不上
+  int freed[Train::kMaxStationNum], left = r - l;
+  for (int k = l; k < r; ++k) freed[k - l] = num;
+  vector<Key> removed;
+  for (auto it = queue_.SeekForward(Key(train_id_hash, date, INT_MIN));
+       left > 0 && it.Valid() && it->first.get<0>() == train_id_hash && it->first.get<1>() == date; it.Next()) {
+    const PendingOrder &order = it->second;
+    if (order.to_rank <= l || r <= order.from_rank) continue;  // 与退回的区段不相交
+    if (seats->RangeMin(order.from_rank, order.to_rank) < order.num) continue;
+    seats->RangeAdd(order.from_rank, order.to_rank, -order.num);
+    filled->push_back(order);
+    removed.push_back(it->first);
+    for (int k = order.from_rank > l ? order.from_rank : l; k < r && k < order.to_rank; ++k)
+      if (freed[k - l] > 0 && (freed[k - l] -= order.num) <= 0) --left;
+  }
+  queue_.MultiRemove(removed);
+}
+
 std::string TrainManager::QueryOrder(std::string_view username) {
   auto user_id_hash = UserIdHasher(username);
-  vector<Order> results;
-  orders_.GetValue(std::make_pair(user_id_hash, INT_MIN), std::make_pair(user_id_hash, 0), &results);
-  std::string ret = std::to_string(results.size());
-  for (auto order : results) append(ret, '\n', order.ToString());
-  return ret;
+  std::string orders;
+  int count = 0;
+  for (auto it = orders_.SeekForward(std::make_pair(user_id_hash, INT_MIN));
+       it.Valid() && it->first <= std::make_pair(user_id_hash, 0); it.Next(), ++count)
+    append(orders, '\n', it->second.ToString(stations_));
+  return std::to_string(count) + orders;
 }
 
 std::string TrainManager::RefundTicket(std::string_view username, const int number) {
   auto user_id_hash = UserIdHasher(username);
-  vector<Order> results;
-  orders_.GetValue(std::make_pair(user_id_hash, INT_MIN), std::make_pair(user_id_hash, 0), &results);
-  if (number > results.size()) return "-1";
-  Order &order = results[number - 1];
-  if (order.status == Order::Status::REFUNDED) return "-1";
+  if (number < 1) return "-1";
+  // 第 number 新的订单的序号是 count - number + 1
+  int seq = OrderCount(user_id_hash) - number + 1;
+  if (seq < 1) return "-1";
+  auto [exist, order] = orders_.GetValue(std::make_pair(user_id_hash, -seq));
+  if (!exist || order.status == Order::Status::REFUNDED) return "-1";
 
   Date start_date = order.start_date;
   auto train_id_hash = TrainIdHasher(order.train_id);
 
+  // 退掉的订单和补上的候补订单一起改状态，第 0 个是退掉的订单
+  vector<std::pair<UserIdHash, int>> changed;
+  changed.push_back(std::make_pair(user_id_hash, -seq));
   if (order.status == Order::Status::PENDING) {
-    pending_orders_.Remove(Tuple(train_id_hash, start_date, order.timestamp));
+    pending_orders_.Erase(train_id_hash, start_date, order.timestamp);
   } else {
-    auto seats = train_seats_.GetValue(std::make_pair(train_id_hash, start_date)).second;  // 买过票所以一定能查到
-    seats.RangeAdd(order.from_rank, order.to_rank, order.num);
-    vector<PendingOrder> pendings;
-    pending_orders_.GetValue(Tuple(train_id_hash, start_date, 0), Tuple(train_id_hash, start_date, INT_MAX), &pendings);
-    for (auto i : pendings)
-      if (seats.RangeMin(i.from_rank, i.to_rank) >= i.num) {
-        auto pending_order = orders_.GetValue(std::make_pair(i.user_id_hash, -i.timestamp)).second;
-        pending_order.status = Order::Status::SUCCESS;  // TODO: 将修改写回文件。
-        orders_.Modify(std::make_pair(i.user_id_hash, -i.timestamp), pending_order);
-        seats.RangeAdd(i.from_rank, i.to_rank, -i.num);  // TODO: 将修改写回文件。
-        pending_orders_.Remove(Tuple(train_id_hash, start_date, i.timestamp));
-      }
-    train_seats_.Modify(std::make_pair(train_id_hash, start_date), seats);
+    // 买过票所以一定能查到，直接在叶子上修改余票；记录的格式由车次决定，trains_ 里就有，不用读堆文件
+    TrainRecord record = trains_.GetValue(train_id_hash).second;
+    auto seats_key = std::make_pair(train_id_hash, start_date);
+    vector<PendingOrder> filled;
+    train_seats_.Update(seats_key, SeatShape::Of(record), [&](TrainSeats &seats) {
+      seats.RangeAdd(order.from_rank, order.to_rank, order.num);
+      pending_orders_.Fill(train_id_hash, start_date, order.from_rank, order.to_rank, order.num, &seats, &filled);
+    });
+    for (size_t i = 0; i < filled.size(); ++i)
+      changed.push_back(std::make_pair(filled[i].user_id_hash, -filled[i].seq));
   }
-  order.status = Order::REFUNDED;
-  // *orders_.GetValue(std::make_pair(user_id_hash, -order.timestamp)).first = order;
-  orders_.Modify(std::make_pair(user_id_hash, -order.timestamp), order);
+  orders_.MultiUpdate(changed, [](int i, Order &changed_order) {
+    changed_order.status = i == 0 ? Order::Status::REFUNDED : Order::Status::SUCCESS;
+  });
   return "0";
 }
 
@@ -1,14 +1,19 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <map>
 
 // #include "b_plus_tree/include/b_plus_tree.hpp"
 #include "bpt/bpt.hpp"
+#include "bpt/flat_hashmap.hpp"
+#include "bpt/heap_file.hpp"
+#include "bpt/page_file.hpp"
 #include "lib/bpt.h"
 #include "lib/char.h"
 #include "lib/datetime.h"
 #include "lib/hash.h"
+#include "lib/seat_kernels.h"
 #include "lib/tuple.h"
 #include "lib/vector.h"
 #include "user.h"
@@ -32,39 +37,118 @@ struct Train {
   bool released = false;
 };
 
+using StationId = uint32_t;
+/**
+ * @brief 站名与稠密编号的双向字典，编号从 0 起按站名第一次出现的顺序分配。
+ * 站名依次追加在堆文件里（uint16_t 长度加不含 '\0' 的站名），启动时全部读入内存。
+ */
+class StationDict {
+ public:
+  static constexpr StationId kNoStation = UINT32_MAX;
+  explicit StationDict(const std::string &filename);
+  /// 返回站名的编号，第一次出现时分配新编号。
+  StationId Intern(std::string_view name);
+  /// 返回站名的编号，没有这个站时返回 kNoStation。
+  StationId Find(std::string_view name);
+  std::string_view Name(StationId id) const { return names_[id]; }
+
+ private:
+  huang::HeapFile file_;
+  vector<std::string_view> names_;  // 指向堆文件的映射，不会失效
+  huang::flat_hashmap<std::string_view, StationId> ids_;
+};
+
+/**
+ * @brief 变长编码的火车开头的定长部分。
+ */
+struct TrainHead {
+  Train::IdType id;
+  char type;
+  int seat_num, station_num;
+  Date start_sale, end_sale;
+};
+/**
+ * @brief 直接读取堆文件中变长编码的火车，不做拷贝。
+ * 编码只保存 station_num 个车站：依次为 TrainHead，sum_prices、arrival_times、departure_times 三个数组，
+ * 以及各站的编号。
+ */
+class TrainView {
+ public:
+  explicit TrainView(const char *data);
+  /// 把 \p train 编码为上述的变长格式，\p station_ids 为各站的编号。
+  static std::string Encode(const Train &train, const StationId *station_ids);
+  const TrainHead &head() const { return *head_; }
+  int station_num() const { return head_->station_num; }
+  StationId station(int i) const { return station_ids_[i]; }
+  int sum_price(int i) const { return sum_prices_[i]; }
+  Time arrival_time(int i) const { return arrival_times_[i]; }
+  Time departure_time(int i) const { return departure_times_[i]; }
+
+ private:
+  const TrainHead *head_;
+  const int *sum_prices_;
+  const Time *arrival_times_, *departure_times_;
+  const StationId *station_ids_;
+};
+/**
+ * @brief trains_ 中存火车在堆文件里的位置，以及不读堆文件就要用到的热数据：发布状态和决定余票记录格式的几个字段。
+ * 车站和各站的时刻、票价在堆文件里，站名在 StationDict 里，只有用到它们的指令才去读。
+ */
+struct TrainRecord {
+  size_t offset;
+  int length;
+  bool released;
+  int seat_num, station_num;
+  Date start_sale, end_sale;
+};
+
 using UserIdHash = size_t;
 using TrainIdHash = size_t;
-using StationHash = size_t;
 /**
  * @brief 记录经过某个站点的火车信息，用于查票。
+ * 键 (StationId, TrainIdHash) 已经带着车次，这里只留归并和日期过滤要用的字段，一项 16 字节。
+ * 车次名、座位数等通过过滤后才去 trains_ 和堆文件里取。
  */
 struct StationTrain {
-  TrainIdHash train_id_hash;
   Time arrival_time, departure_time;
   int sum_price;  // 累计价格
-  int rank;  // 储存此车站是该列车途径的第几个车站，用于在查票时判断列车运行方向
-  Train::IdType train_id;
-  Date start_sale, end_sale;
-  int seat_num, station_num;
-  StationTrain() : train_id("xxxxxxxxxxxxxxxxxxxxxxxx") {}
-  StationTrain(TrainIdHash train_id_hash_, Time arrival_time_, Time departure_time_, int sum_price_, int rank_,
-      const Train &train)
-      : train_id_hash(train_id_hash_),
-        arrival_time(arrival_time_),
+  // rank 储存此车站是该列车途径的第几个车站（小于 kMaxStationNum），用于在查票时判断列车运行方向；
+  // start_day、end_day 是售票首末日期在一年中的第几天。三者挤在一个 int 里
+  int rank : 8, start_day : 12, end_day : 12;
+  StationTrain() : rank(0), start_day(0), end_day(0) {}
+  StationTrain(Time arrival_time_, Time departure_time_, int sum_price_, int rank_, const TrainHead &train)
+      : arrival_time(arrival_time_),
         departure_time(departure_time_),
         sum_price(sum_price_),
         rank(rank_),
-        train_id(train.id),
-        start_sale(train.start_sale),
-        end_sale(train.end_sale),
-        seat_num(train.seat_num),
-        station_num(train.station_num) {}
+        start_day(train.start_sale.minutes() / kOneDay.minutes()),
+        end_day(train.end_sale.minutes() / kOneDay.minutes()) {}
+  Date start_sale() const { return Date(start_day * kOneDay.minutes()); }
+  Date end_sale() const { return Date(end_day * kOneDay.minutes()); }
 };
+/**
+ * @brief 站对索引中的一项：一趟车从 from 站直达 to 站，查票所需的全部信息。
+ */
+struct PairTrain {
+  Train::IdType train_id;
+  int from_rank, to_rank;
+  Time departure_time, arrival_time;  // 离开 from 站、到达 to 站的时刻
+  int price;
+  Date start_sale, end_sale;
+  int seat_num, station_num;
+  PairTrain() {}
+  PairTrain(const TrainView &train, int from_rank_, int to_rank_);
+  /// \p from 、\p to 是这趟车在两站的 station_trains_ 项，其余字段取自车头。
+  PairTrain(const TrainHead &train, const StationTrain &from, const StationTrain &to);
+};
+/// 站对索引的键：(from 站, to 站, train_id_hash)。
+using PairTrainKey = Tuple<StationId, StationId, TrainIdHash>;
 /**
  * @brief 记录车次剩余座位信息。
  */
 struct TrainSeats {
-  int seat_num[Train::kMaxStationNum];  // seat_num[i] 表示从 stations[i] 到 stations[i + 1] 的剩余座位数
+  // seat_num[i] 表示从 stations[i] 到 stations[i + 1] 的剩余座位数，末尾留出 SIMD 读写整组的余量
+  int seat_num[SeatSlots(Train::kMaxStationNum)];
   TrainSeats();
   TrainSeats(int initial_seat_num, int station_num);
   // 左闭右开
@@ -91,6 +175,96 @@ struct TrainSeatsWrap : public TrainSeats {
   void RangeAdd(int l, int r, int x);
   int operator[](int);
 };
+/**
+ * @brief 决定一趟车的余票记录格式的信息，车次发布后不再改变。
+ */
+struct SeatShape {
+  int seat_num, station_num;
+  Date start_sale, end_sale;
+  /// 从 TrainHead、TrainRecord、PairTrain 等带着这几个字段的结构中取出。
+  template <class T>
+  static SeatShape Of(const T &train) {
+    return {train.seat_num, train.station_num, train.start_sale, train.end_sale};
+  }
+};
+/**
+ * @brief 余票的两种存法。
+ * - kRecord：每个 (车次, 日期) 一条记录，按字节数分到几棵 B+ 树里。
+ * - kMatrix：每趟车一个 日期 × 区段 的矩阵，连续地放在页文件里。
+ */
+enum class SeatLayout { kRecord, kMatrix };
+/**
+ * @brief 按 (车次, 日期) 存余票，记录的长度取决于车次。
+ *
+ * 一条记录只存 station_num - 1 段，座位数不超过 65535 时每段用 16 位。
+ *
+ * kRecord 布局下，B+ 树的值是定长的，所以记录按字节数分到几棵值长不同的树里：
+ * 5 站的车一条只占 32 字节，一片叶子能放下更多天。
+ *
+ * kMatrix 布局下，一趟车第一次售票时才分配它的矩阵：售票期内每天一行，所有行放在连续的若干页中，
+ * 一行不跨页。seat_matrix_ 只记矩阵的第一页，查某天的余票是一次查找加一次偏移计算，
+ * 相邻日期的行在同一页上。
+ *
+ * 调用者每次都传入车次的 SeatShape 来确定记录的格式。读出的记录展开成 TrainSeats，供 SIMD 的区间操作使用。
+ */
+class SeatStore {
+ public:
+  using Key = std::pair<TrainIdHash, Date>;
+  /// 已有数据时沿用数据所在的布局，忽略 \p layout 。
+  explicit SeatStore(SeatLayout layout);
+  SeatLayout Layout() const { return layout_; }
+  /// 读出一条记录到 \p seats ，不存在时返回 false。
+  bool Get(const Key &key, const SeatShape &shape, TrainSeats *seats);
+  void Put(const Key &key, const SeatShape &shape, const TrainSeats &seats);
+  /// 在原处修改一条已存在的记录，不存在时返回 false。
+  template <class Fn>
+  bool Update(const Key &key, const SeatShape &shape, Fn fn);
+
+  /// 一次查询中要读的一段余票：车次在某天从第 l 段到第 r 段（左闭右开）。
+  struct Range {
+    Key key;
+    SeatShape shape;
+    int l, r;
+  };
+  /// 批量求每个 Range 的最小余票，依次追加到 \p ans ，没有记录的车次视为满座。各棵树上的键排序后一趟查完。
+  void RangeMin(const vector<Range> &ranges, vector<int> *ans);
+
+ private:
+  template <int kBytes>
+  struct Record {
+    char data[kBytes];
+  };
+  static constexpr int kSizeClasses = 5;
+  static constexpr int kPageSize = 4096;
+  using Page = Record<kPageSize>;
+
+  SeatLayout layout_;
+  // 叶子都在 8 KiB 左右。最后一类放得下 99 段 32 位计数
+  huang::BPlusTree<Key, Record<32>, 400, 170> seats32_{"train_seats_32_", huang::StorageMode::kMmap};
+  huang::BPlusTree<Key, Record<64>, 400, 100> seats64_{"train_seats_64_", huang::StorageMode::kMmap};
+  huang::BPlusTree<Key, Record<128>, 400, 56> seats128_{"train_seats_128_", huang::StorageMode::kMmap};
+  huang::BPlusTree<Key, Record<256>, 400, 30> seats256_{"train_seats_256_", huang::StorageMode::kMmap};
+  huang::BPlusTree<Key, Record<400>, 400, 20> seats400_{"train_seats_400_", huang::StorageMode::kMmap};
+  // 车次 -> 它的矩阵的第一页
+  huang::BPlusTree<TrainIdHash, int, 400, 500> seat_matrix_{"seat_matrix_", huang::StorageMode::kMmap};
+  huang::PageFile<Page> seat_pages_{"seat_matrix_pages.dat", huang::StorageMode::kMmap};
+
+  /// 对存放这种车次记录的树调用 fn(tree, narrow)，narrow 表示用 16 位计数。
+  template <class Fn>
+  bool WithTree(const SeatShape &shape, Fn fn);
+  /// 在矩阵中找到 \p key 那一行所在的页和页内偏移，矩阵还没分配时返回 false。
+  bool FindRow(const Key &key, const SeatShape &shape, int *page, int *offset);
+  /// 已知矩阵第一页时 \p key 那一行的位置。
+  static void RowOf(const Key &key, const SeatShape &shape, int first_page, int *page, int *offset);
+  /// 为车次分配矩阵，每一行都是满座位数。
+  void AllocateMatrix(TrainIdHash train_id_hash, const SeatShape &shape);
+  /// 记录在第几棵树里，从小到大
+  static int SizeClass(const SeatShape &shape);
+  static bool Narrow(const SeatShape &shape) { return shape.seat_num <= UINT16_MAX; }
+  static int RowBytes(const SeatShape &shape);
+  static void Pack(const TrainSeats &seats, int segments, bool narrow, char *data);
+  static void Unpack(const char *data, int segments, bool narrow, TrainSeats *seats);
+};
 /**
  * @brief 记录一张车票的信息。
  */
@@ -124,11 +298,11 @@ struct Order {
   Date start_date;
   User::IdType username;
   Train::IdType train_id;
-  Train::StationName from_station, to_station;
+  StationId from_station, to_station;
   int from_rank, to_rank;
   DateTime dep_datetime, arr_datetime;
 
-  std::string ToString() const;
+  std::string ToString(const StationDict &stations) const;
 };
 /**
  * @brief 记录候补车票信息。
@@ -136,10 +310,42 @@ struct Order {
 struct PendingOrder {
   int timestamp, num, from_rank, to_rank;
   UserIdHash user_id_hash;
+  int seq;  // 在 orders_ 中的序号
+};
+/**
+ * @brief 按 (车次, 日期) 排队的候补订单。
+ *
+ * 每次操作之后，队列里都没有能补上的订单。退票只让 [l, r) 这几段多出座位，所以补订单时按下单顺序在叶子上
+ * 直接读，区间与 [l, r) 不相交的订单只比较两个整数就跳过；退回的座位在每一段上都被用完后，余票不比退票前多，
+ * 后面的订单都补不上，就此停下。补上的订单最后一次从树里删掉。
+ */
+class PendingQueue {
+ public:
+  using Key = Tuple<TrainIdHash, Date, int>;  // (车次, 日期, 下单时间)
+  void Push(TrainIdHash train_id_hash, Date date, const PendingOrder &order);
+  /// 取消一个还在排队的订单。
+  void Erase(TrainIdHash train_id_hash, Date date, int timestamp);
+  /**
+   * @brief 退票让 \p seats 在 [l, r) 上多出了 \p num 个座位，按下单顺序补上能补的候补订单。
+   * 补上的订单从 \p seats 中扣掉座位，移出队列并追加到 \p filled 。
+   */
+  void Fill(TrainIdHash train_id_hash, Date date, int l, int r, int num, TrainSeats *seats,
+      vector<PendingOrder> *filled);
+
+ private:
+  huang::BPlusTree<Key, PendingOrder, 400, 120> queue_{"pending_queue_"};
 };
 
 class TrainManager {
  public:
+  static constexpr size_t kDefaultPairIndexBudget = 64UL << 20;
+  /**
+   * @param pair_index_budget 站对索引最多占用的磁盘字节数，0 表示不用站对索引。
+   * @param seat_layout 新数据库的余票布局，已有数据时沿用原来的布局。
+   */
+  explicit TrainManager(
+      size_t pair_index_budget = kDefaultPairIndexBudget, SeatLayout seat_layout = SeatLayout::kRecord);
+
   /**
    * @brief 添加一辆火车。
    */
@@ -153,6 +359,14 @@ class TrainManager {
    * 发布后的车次不可被删除，可发售车票。
    */
   std::string ReleaseTrain(std::string_view train_id);
+  /// 依次发布 \p train_ids 中的车次，跳过不存在或已发布的，返回发布成功的车次数。
+  std::string ReleaseTrains(const vector<std::string_view> &train_ids);
+
+  /**
+   * @brief 导入一整张时刻表：添加并发布 \p trains 中的所有车次，跳过已存在或重复的 train_id。
+   * 索引为空时一次性自底向上建树，返回成功导入的车次数。
+   */
+  std::string ImportTrains(vector<Train> &trains);
 
   /// 询问符合条件的火车。
   std::string QueryTrain(std::string_view train_id, Date target_date);
@@ -200,25 +414,62 @@ class TrainManager {
  private:
   Hasher<User::IdType> UserIdHasher;
   Hasher<Train::IdType> TrainIdHasher;
-  Hasher<Train::StationName> StationHasher;
 
   // std::map<TrainIdHash, Train> trains_;
   // std::map<TrainIdHash, TrainDate> train_dates_;
   // std::map<std::pair<TrainIdHash, Date>, TrainSeats> train_seats_;
   // std::map<std::pair<StationHash, TrainIdHash>, StationTrain> station_trains_;
 
-  // std::map<std::pair<UserIdHash, int>, Order> orders_;
+  // std::map<std::pair<UserIdHash, int>, Order> orders_;  // (用户, -序号)
   // std::map<Tuple<TrainIdHash, Date, int>, PendingOrder> pending_orders_;
 
-  huang::BPlusTree<TrainIdHash, Train, 600, 2> trains_{"trains_"};
-  huang::BPlusTree<std::pair<TrainIdHash, Date>, TrainSeats, 400, 20> train_seats_{"train_seats_"};
-  huang::BPlusTree<std::pair<StationHash, TrainIdHash>, StationTrain, 400, 120> station_trains_{"station_trains_"};
+  StationDict stations_{"stations.dat"};
+  // 火车按 station_num 变长编码存进堆文件，B+ 树里只放位置
+  huang::HeapFile train_heap_{"trains_heap.dat"};
+  huang::BPlusTree<TrainIdHash, TrainRecord, 600, 100> trains_{"train_records_"};
+  // 查票时最热的两个索引直接 mmap 到内存，由操作系统负责缓存
+  SeatStore train_seats_;
+  // 一项只有 32 字节，叶子放 300 项，和以前放 120 项时一样大
+  huang::BPlusTree<std::pair<StationId, TrainIdHash>, StationTrain, 400, 300> station_trains_{
+      "station_stops_", huang::StorageMode::kMmap};
+
+  /**
+   * 站对索引：发布车次时为它的每一对 (i, j) 站（i 在 j 之前）存一项，查票时只需扫一小段。
+   * 项数不超过 pair_budget_；预算用完后新出现项的站对整个移出索引，只留一个 train_id_hash 为 0 的
+   * 标记，查这个站对时回退到 station_trains_ 上的归并。缓存大小由 BufferManager 的预算约束。
+   */
+  huang::BPlusTree<PairTrainKey, PairTrain, 400, 40> pair_trains_{"pair_trains_"};
+  size_t pair_budget_;
+  bool pair_index_on_;  // 为假时索引缺了一些车次，不再使用
 
-  huang::BPlusTree<std::pair<UserIdHash, int>, Order, 400, 50> orders_{"orders_"};
-  huang::BPlusTree<Tuple<TrainIdHash, Date, int>, PendingOrder, 400, 120> pending_orders_{"pending_orders_"};
+  /// 每个用户的订单从 1 开始依次编号，键是 (用户, -序号)，最新的订单排在最前，第 n 新的订单可以直接查到。
+  huang::BPlusTree<std::pair<UserIdHash, int>, Order, 400, 50> orders_{"user_orders_"};
+  PendingQueue pending_orders_;
 
-  TrainSeatsWrap GetSeats(TrainIdHash train_id_hash, Date date, int initial_seat_num, int station_num);
-  void UpdateSeats(TrainIdHash train_id_hash, Date date, const TrainSeatsWrap &seats);
+  TrainView GetTrain(const TrainRecord &record) { return TrainView(train_heap_.Get(record.offset)); }
+  /// 把火车存进堆文件，返回它在 trains_ 中的记录。
+  TrainRecord PutTrain(const Train &train, bool released);
+  /**
+   * @brief 发布一批车次，返回发布成功的车次数。
+   * trains_ 上一趟 MultiUpdate 标记发布，各站的 station_trains_ 项和各站对的索引项收集起来排好序一次插入。
+   */
+  int Release(const vector<std::string_view> &train_ids);
+  TrainSeatsWrap GetSeats(TrainIdHash train_id_hash, Date date, const SeatShape &shape);
+  /// 用户下过的订单数，也就是最新订单的序号。
+  int OrderCount(UserIdHash user_id_hash);
+  bool UsePairIndex() const { return pair_index_on_ && pair_budget_ > 0; }
+  /**
+   * @brief 把刚发布的一批车次的所有站对加入站对索引。
+   * 站对项排好序后按站对分组，一组要么整组放入，要么整个站对回退到归并；索引为空时直接自底向上建树。
+   */
+  void IndexPairs(const vector<std::pair<TrainIdHash, TrainView>> &trains);
+  /// 在站对索引里查票，站对不在索引中时返回 false。
+  bool QueryPairIndex(Date date, StationId from_id, StationId to_id, vector<Ticket> &result,
+      vector<SeatStore::Range> &seat_ranges);
+  /// 如果 \p train 在 \p date 从 from 站出发的车次在售，把它加入 \p result ，要查的余票加入 \p seat_ranges 。
+  void AddDirectTicket(vector<Ticket> &result, vector<SeatStore::Range> &seat_ranges, Date date,
+      TrainIdHash train_id_hash, const PairTrain &train);
+  void UpdateSeats(TrainIdHash train_id_hash, Date date, const SeatShape &shape, const TrainSeatsWrap &seats);
 };
 
 }  // namespace lin
\ No newline at end of file
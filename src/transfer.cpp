@@ -0,0 +1,148 @@
+#include "transfer.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "lib/utils.h"
+#include "lib/worker_pool.h"
+
+namespace lin {
+
+namespace {
+std::unique_ptr<WorkerPool> transfer_pool;  // 为空时串行
+}  // namespace
+
+void TransferEngine::SetThreads(int threads) {
+  transfer_pool.reset(threads > 1 ? new WorkerPool(threads) : nullptr);
+}
+
+TransferEngine::TransferEngine(Date date, TrainManager::SortOrder sort_order, const vector<TransferLeg> &start,
+    const vector<TransferLeg> &end)
+    : date_(date), sort_order_(sort_order), start_(start), end_(end), min_duration_(0), min_cost_(0) {
+  for (size_t x = 0; x < end_.size(); ++x) {
+    const StationTrain &j = *end_[x].train;
+    const TrainView &j_train = end_[x].view;
+    for (int k = 0; k < j.rank; ++k)
+      boardings_.push_back({j_train.station(k), static_cast<int>(x), k, j.arrival_time - j_train.departure_time(k),
+          j.sum_price - j_train.sum_price(k)});
+  }
+  Sort(boardings_.begin(), boardings_.end(), [](const Boarding &a, const Boarding &b) {
+    if (a.station != b.station) return a.station < b.station;
+    if (a.second != b.second) return a.second < b.second;
+    return a.rank < b.rank;
+  });
+  for (size_t begin = 0, end; begin < boardings_.size(); begin = end) {
+    StationBoardings range = {static_cast<int>(begin), 0, boardings_[begin].duration, boardings_[begin].cost};
+    for (end = begin; end < boardings_.size() && boardings_[end].station == boardings_[begin].station; ++end) {
+      if (boardings_[end].duration < range.min_duration) range.min_duration = boardings_[end].duration;
+      range.min_cost = std::min(range.min_cost, boardings_[end].cost);
+    }
+    range.end = end;
+    stations_[boardings_[begin].station] = range;
+    if (begin == 0 || range.min_duration < min_duration_) min_duration_ = range.min_duration;
+    if (begin == 0 || range.min_cost < min_cost_) min_cost_ = range.min_cost;
+  }
+}
+
+bool TransferEngine::Hopeless(const TransferPlan &plan, Duration duration, int cost) const {
+  // 排序关键字严格更差的方案不可能被 CompareTime / CompareCost 选中
+  if (!plan.found) return false;
+  if (sort_order_ == TrainManager::SortOrder::TIME) return plan.ticket.duration < duration;
+  return plan.ticket.cost < cost;
+}
+
+bool TransferEngine::Better(const TransferTicket &cur, const TransferTicket &ans) const {
+  return sort_order_ == TrainManager::SortOrder::TIME ? CompareTime(cur, ans) : CompareCost(cur, ans);
+}
+
+TransferPlan TransferEngine::Solve() const {
+  int n = start_.size(), tasks = (n + kStartTrainsPerTask - 1) / kStartTrainsPerTask;
+  // 只有一块时不值得唤醒线程；串行时不分块，剪枝的界在所有车次间共享
+  if (!transfer_pool || tasks < 2 || boardings_.empty()) return Solve(0, n);
+  vector<TransferPlan> plans;
+  for (int t = 0; t < tasks; ++t) plans.push_back(TransferPlan());
+  transfer_pool->Run(tasks, [&](int t) {
+    plans[t] = Solve(t * kStartTrainsPerTask, std::min(n, (t + 1) * kStartTrainsPerTask));
+  });
+  // 按块的顺序合并，与串行时一样，较早的方案在平局时胜出。CompareTime / CompareCost 是全序上的严格比较，
+  // 各块最优解中的最优解就是全体方案中的最优解，所以结果与线程数无关
+  TransferPlan plan;
+  for (int t = 0; t < tasks; ++t)
+    if (plans[t].found && (!plan.found || Better(plans[t].ticket, plan.ticket))) plan = plans[t];
+  return plan;
+}
+
+TransferPlan TransferEngine::Solve(int begin, int end) const {
+  TransferPlan plan;
+  TransferTicket &ans = plan.ticket, cur;
+  // 一趟出发车次的候选方案：boardings_ 中的下标，以及换乘站是它的第几站
+  std::vector<std::pair<int, int>> candidates;
+  for (int x = begin; x < end; ++x) {
+    const StationTrain &i = *start_[x].train;
+    const TrainView &i_train = start_[x].view;
+    Date i_start_date = date_ - i.departure_time.GetDays();
+    candidates.clear();
+    for (int k = i.rank + 1; k < i_train.station_num(); ++k) {
+      Duration duration1 = i_train.arrival_time(k) - i.departure_time;
+      int cost1 = i_train.sum_price(k) - i.sum_price;
+      // 越往后的换乘站第一程越久越贵，之后的站也不用看了
+      if (Hopeless(plan, duration1 + min_duration_, cost1 + min_cost_)) break;
+      auto it = stations_.find(i_train.station(k));
+      if (it == stations_.end()) continue;
+      const StationBoardings &range = it->second;
+      if (Hopeless(plan, duration1 + range.min_duration, cost1 + range.min_cost)) continue;
+      for (int b = range.begin; b < range.end; ++b)
+        if (end_[boardings_[b].second].train_id_hash != start_[x].train_id_hash) candidates.push_back({b, k});
+    }
+    // 恢复逐对枚举 (j, 换乘站) 的顺序。lin::Sort 用 rand() 选枢轴，不能在多个线程里用
+    std::sort(candidates.begin(), candidates.end(), [&](const std::pair<int, int> &a, const std::pair<int, int> &b) {
+      const Boarding &p = boardings_[a.first], &q = boardings_[b.first];
+      if (p.second != q.second) return p.second < q.second;
+      if (p.rank != q.rank) return p.rank < q.rank;
+      return a.second < b.second;
+    });
+    for (auto [b, k] : candidates) {
+      const Boarding &boarding = boardings_[b];
+      const StationTrain &j = *end_[boarding.second].train;
+      const TrainView &j_train = end_[boarding.second].view;
+      DateTime i_arr_datetime = i_start_date + i_train.arrival_time(k);
+      auto [i_arr_date, i_arr_time] = i_arr_datetime.GetDateAndTime();
+      auto [j_dep_days, j_dep_time] = j_train.departure_time(boarding.rank).GetDayTime();
+      // j_start_date 为 j 车可行的最早发车日期，由于可以在中转站停留任意长的时间，故只需要计算最早发车日期
+      Date j_start_date = i_arr_date - j_dep_days;
+      if (j_dep_time < i_arr_time) j_start_date += kOneDay;
+      j_start_date = std::max(j_start_date, j_train.head().start_sale);  // 发车日期不能早于开始售票的日期
+      if (j_train.head().end_sale < j_start_date) continue;
+
+      DateTime j_dep_datetime = j_start_date + j_train.departure_time(boarding.rank);
+      cur.ticket1.train_id = i_train.head().id;
+      cur.ticket1.cost = i_train.sum_price(k) - i.sum_price;
+      cur.ticket2.train_id = j_train.head().id;
+      cur.ticket2.cost = boarding.cost;
+      cur.cost = cur.ticket1.cost + cur.ticket2.cost;
+      cur.duration =
+          (i_train.arrival_time(k) - i.departure_time) + boarding.duration + (j_dep_datetime - i_arr_datetime);
+
+      bool is_better = Better(cur, ans);
+      plan.found = true;
+      if (is_better) {
+        ans = cur;
+        ans.ticket1.start_time = i_start_date + i.departure_time;
+        ans.ticket1.end_time = i_arr_datetime;
+        ans.ticket2.start_time = j_dep_datetime;
+        ans.ticket2.end_time = j_start_date + j.arrival_time;
+        plan.first = x;
+        plan.second = boarding.second;
+        plan.transfer_rank1 = k;
+        plan.transfer_rank2 = boarding.rank;
+        plan.transfer_station = boarding.station;
+        plan.start_date1 = i_start_date;
+        plan.start_date2 = j_start_date;
+      }
+    }
+  }
+  return plan;
+}
+
+}  // namespace lin
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "bpt/flat_hashmap.hpp"
+#include "lib/datetime.h"
+#include "lib/vector.h"
+#include "train.h"
+
+namespace lin {
+
+/**
+ * @brief 换乘查询的一个候选车次：它在出发站（或到达站）的记录，以及整趟车。
+ */
+struct TransferLeg {
+  const StationTrain *train;
+  TrainIdHash train_id_hash;
+  TrainView view;
+};
+
+/**
+ * @brief 换乘方案中除余票以外的全部信息，余票由调用者去 B+ 树里查。
+ */
+struct TransferPlan {
+  bool found = false;
+  TransferTicket ticket;
+  int first = -1, second = -1;  // 两趟车在 start / end 中的下标
+  int transfer_rank1 = 0, transfer_rank2 = 0;  // 换乘站分别是两趟车的第几站
+  StationId transfer_station = StationDict::kNoStation;
+  Date start_date1, start_date2;  // 两趟车的始发日期
+};
+
+/**
+ * @brief 恰好换乘一次的查询引擎，只读内存中的车次，不访问 B+ 树。
+ *
+ * 到达一侧的每趟车只读一次：它在到达站之前经过的每个站，连同从该站到到达站的时间和票价，
+ * 建成一张以站号为键的哈希表。出发一侧的车次依次用它之后经过的站去探测这张表。
+ * 若一个候选方案在排序关键字上的下界已经比当前最优解差，就不再计算它。
+ *
+ * 候选方案按 (出发车次, 到达车次, 换乘站在到达车次上的序号) 的顺序比较，
+ * 与逐对枚举两趟车时相同，所以平局时选出的方案也相同。
+ *
+ * 出发车次多时，Solve() 把它们按固定大小分块，交给 SetThreads() 建好的线程池，
+ * 各块的最优解再按块的顺序合并。求解只读内存中的车次和建好的表，
+ * 不碰缓存池（缓存池不是线程安全的），余票由调用者在合并之后查。
+ */
+class TransferEngine {
+ public:
+  /**
+   * @param start 经过出发站且在 \p date 有车的车次
+   * @param end 经过到达站的车次
+   */
+  TransferEngine(Date date, TrainManager::SortOrder sort_order, const vector<TransferLeg> &start,
+      const vector<TransferLeg> &end);
+
+  /// 求解 query_transfer 所用的线程数（包括调用者），1 表示串行；在第一次查询之前设置。
+  static void SetThreads(int threads);
+
+  /// 第一程取 start 中任意车次时的最优方案。
+  TransferPlan Solve() const;
+  /// 第一程取 start 中下标在 [begin, end) 的车次时的最优方案。
+  TransferPlan Solve(int begin, int end) const;
+
+ private:
+  /// 第二程在某个换乘站上车
+  struct Boarding {
+    StationId station;
+    int second, rank;  // 车次在 end 中的下标，换乘站是它的第几站
+    Duration duration;  // 从换乘站到到达站的时间
+    int cost;
+  };
+  /// 一个换乘站的全部 Boarding 在 boardings_ 中的区间，以及它们的时间和票价的最小值
+  struct StationBoardings {
+    int begin, end;
+    Duration min_duration;
+    int min_cost;
+  };
+
+  /// 并行时每个任务负责的出发车次数，与线程数无关，所以结果也与线程数无关
+  static constexpr int kStartTrainsPerTask = 8;
+
+  Date date_;
+  TrainManager::SortOrder sort_order_;
+  const vector<TransferLeg> &start_, &end_;
+  vector<Boarding> boardings_;  // 按 (station, second, rank) 排序
+  mutable huang::flat_hashmap<StationId, StationBoardings> stations_;  // 建好后只读，find() 没有 const 版本
+  Duration min_duration_;  // 所有 Boarding 中的最小值
+  int min_cost_;
+
+  /// 时间和票价至少为 \p duration 、\p cost 的方案是否一定不优于 \p plan。
+  bool Hopeless(const TransferPlan &plan, Duration duration, int cost) const;
+  /// \p cur 是否比 \p ans 更优
+  bool Better(const TransferTicket &cur, const TransferTicket &ans) const;
+};
+
+}  // namespace lin